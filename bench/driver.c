@@ -0,0 +1,506 @@
+// End-to-end benchmark driver.
+//
+// Runs jftui's own network, SAX parser and disk cache code against the mock
+// server in mock.c (forked in-process unless --server is given) and prints
+// the results as JSON on stdout.
+//
+// Metrics, per run:
+//  - time_to_first_item_ms: from issuing the listing request to the first
+//      item line printed by the parser thread;
+//  - listing_ms: the whole JF_REQUEST_SAX_PROMISCUOUS listing request;
+//  - selector_to_playlist_ms: moving the first --select items from the
+//      payload cache to the playlist, as jf_menu_child_dispatch does;
+//  - playback_start_ms: resolving the first playlist item, split in --parts
+//      files, the way jf_playback_play_item does (item and additionalparts
+//      in parallel, resume markers of all parts in one request) up to the
+//      point loadfile would be issued;
+//  - playback_start_single_part_ms: the same for the second playlist item,
+//      a single file whose additionalparts request the listing lets us skip.
+//
+// With --tls (forked mock server only) the runs go over HTTPS and are
+// preceded by checks on the connection handling, reported under "tls" and
+// failing the driver if any does not hold:
+//  - prewarm_reused: the first real request after jf_net_prewarm goes over
+//      the connection the prewarm opened, without a new handshake;
+//  - session_resumed: a second connection, forced by two requests the mock
+//      holds until both have arrived, resumes the TLS session of the first;
+//  - h2_offered: every handshake offers h2 through ALPN. The mock settles on
+//      http/1.1 regardless, so multiplexing itself is not measured.
+//
+// Usage: bench_driver [--runs N] [--select N] [--server URL]
+//                     [--port N] [--latency-ms N] [--bandwidth-kbps N]
+//                     [--items N] [--parts N] [--tls]
+
+#include "mock.h"
+#include "../src/shared.h"
+#include "../src/config.h"
+#include "../src/net.h"
+#include "../src/json.h"
+#include "../src/disk.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+////////// CONSTANTS //////////
+#define JF_BENCH_RUNS_DEFAULT 5
+#define JF_BENCH_SELECT_DEFAULT 1000
+#define JF_BENCH_USERID "0123456789abcdef0123456789abcdef"
+#define JF_BENCH_METRICS 5
+#define JF_BENCH_TLS_TIMEOUT_MS 10000
+///////////////////////////////
+
+
+////////// TLS CHECKS //////////
+typedef struct jf_bench_tls_checks {
+    bool prewarm_reused;
+    bool session_resumed;
+    bool h2_offered;
+} jf_bench_tls_checks;
+////////////////////////////////
+
+
+////////// GLOBAL VARIABLES //////////
+jf_options g_options;
+jf_global_state g_state;
+mpv_handle *g_mpv_ctx = NULL;
+//////////////////////////////////////
+
+
+////////// STATIC VARIABLES //////////
+static pid_t s_server_pid = 0;
+static FILE *s_results = NULL;
+// stdout of the parser thread is redirected to a pipe we watch
+static int s_stdout_pipe[2];
+static atomic_bool s_awaiting_first_item = false;
+static pthread_mutex_t s_first_item_mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_first_item_cv = PTHREAD_COND_INITIALIZER;
+static double s_first_item_time = 0;
+//////////////////////////////////////
+
+
+////////// STATIC FUNCTIONS //////////
+static double jf_bench_now(void);
+static void *jf_bench_stdout_thread(void *arg);
+static double jf_bench_listing(double *first_item_ms);
+static double jf_bench_selector_to_playlist(const size_t count);
+static jf_reply *jf_bench_additional_parts_request(const jf_menu_item *item);
+static double jf_bench_playback_start(const size_t n);
+static int jf_bench_compare_double(const void *a, const void *b);
+static void jf_bench_print_metric(const char *name, double *samples, const size_t count, const bool last);
+
+// Runs the checks described at the top of the file against the forked mock
+// server. Must come before any other request.
+// CAN FATAL.
+static void jf_bench_tls(const jf_mock_counters *counters, jf_bench_tls_checks *checks);
+//////////////////////////////////////
+
+
+////////// STUBS //////////
+void jf_exit(int sig)
+{
+    if (s_server_pid > 0) kill(s_server_pid, SIGTERM);
+    jf_disk_clear();
+    _exit(sig);
+}
+
+
+size_t jf_menu_user_ask_selection(const size_t l, __attribute__((unused)) const size_t r)
+{
+    // only reached with multiple versions, which the mock does not serve
+    return l;
+}
+///////////////////////////
+
+
+////////// MEASUREMENTS //////////
+static double jf_bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+
+static void *jf_bench_stdout_thread(__attribute__((unused)) void *arg)
+{
+    char buf[65536];
+    ssize_t n;
+
+    while ((n = read(s_stdout_pipe[0], buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (atomic_exchange(&s_awaiting_first_item, false)) {
+            pthread_mutex_lock(&s_first_item_mut);
+            s_first_item_time = jf_bench_now();
+            pthread_cond_signal(&s_first_item_cv);
+            pthread_mutex_unlock(&s_first_item_mut);
+        }
+    }
+    return NULL;
+}
+
+
+static double jf_bench_listing(double *first_item_ms)
+{
+    jf_reply *reply;
+    jf_growing_buffer *url;
+    double start, end;
+
+    url = jf_growing_buffer_scratch();
+    jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+    JF_GROWING_BUFFER_APPEND_LITERAL(url,
+            "/items?sortby=isfolder,parentindexnumber,indexnumber,productionyear,sortname&parentid=00000000000000000000000000000001");
+
+    pthread_mutex_lock(&s_first_item_mut);
+    s_first_item_time = 0;
+    pthread_mutex_unlock(&s_first_item_mut);
+    atomic_store(&s_awaiting_first_item, true);
+
+    start = jf_bench_now();
+    reply = jf_net_request(jf_growing_buffer_cstr(url), JF_REQUEST_SAX_PROMISCUOUS, JF_HTTP_GET, NULL);
+    end = jf_bench_now();
+    if (JF_REPLY_PTR_HAS_ERROR(reply)) {
+        fprintf(stderr, "FATAL: listing request failed: %s.\n", jf_reply_error_string(reply));
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    jf_reply_free(reply);
+    fflush(stdout);
+
+    // the pipe reader may lag behind a little
+    pthread_mutex_lock(&s_first_item_mut);
+    while (s_first_item_time == 0) {
+        pthread_cond_wait(&s_first_item_cv, &s_first_item_mut);
+    }
+    *first_item_ms = s_first_item_time - start;
+    pthread_mutex_unlock(&s_first_item_mut);
+
+    return end - start;
+}
+
+
+static double jf_bench_selector_to_playlist(const size_t count)
+{
+    jf_menu_item *item;
+    size_t i, available = jf_disk_payload_item_count();
+    double start;
+
+    start = jf_bench_now();
+    for (i = 1; i <= count && i <= available; i++) {
+        item = jf_disk_payload_get_item(i);
+        jf_disk_playlist_add_item(item);
+        jf_menu_item_free(item);
+    }
+    return jf_bench_now() - start;
+}
+
+
+static jf_reply *jf_bench_additional_parts_request(const jf_menu_item *item)
+{
+    jf_growing_buffer *url;
+
+    // as jf_playback_additional_parts_request
+    if (item->part_count == 1) return NULL;
+
+    url = jf_growing_buffer_scratch();
+    JF_GROWING_BUFFER_APPEND_LITERAL(url, "/videos/");
+    jf_growing_buffer_append(url, item->id, 0);
+    JF_GROWING_BUFFER_APPEND_LITERAL(url, "/additionalparts");
+    return jf_net_request(jf_growing_buffer_cstr(url), JF_REQUEST_ASYNC_IN_MEMORY, JF_HTTP_GET, NULL);
+}
+
+
+static double jf_bench_playback_start(const size_t n)
+{
+    jf_menu_item *item;
+    jf_reply *replies[2], *parts;
+    jf_growing_buffer *url;
+    size_t i;
+    double start;
+
+    start = jf_bench_now();
+    item = jf_disk_playlist_get_item(n);
+
+    url = jf_growing_buffer_scratch();
+    jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+    JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items/");
+    jf_growing_buffer_append(url, item->id, 0);
+    replies[0] = jf_net_request(jf_growing_buffer_cstr(url), JF_REQUEST_ASYNC_IN_MEMORY, JF_HTTP_GET, NULL);
+    replies[1] = jf_bench_additional_parts_request(item);
+    jf_net_await(replies[0]);
+    if (JF_REPLY_PTR_HAS_ERROR(replies[0])) {
+        fprintf(stderr, "FATAL: item request failed: %s.\n", jf_reply_error_string(replies[0]));
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    if (jf_json_parse_video(item, replies[0]->payload) > 1) {
+        if (replies[1] == NULL) {
+            replies[1] = jf_bench_additional_parts_request(item);
+        }
+        jf_net_await(replies[1]);
+        if (JF_REPLY_PTR_HAS_ERROR(replies[1])) {
+            fprintf(stderr, "FATAL: additionalparts request failed: %s.\n", jf_reply_error_string(replies[1]));
+            jf_exit(JF_EXIT_FAILURE);
+        }
+        jf_json_parse_additional_parts(item, replies[1]->payload);
+    }
+    jf_reply_free(replies[0]);
+    if (replies[1] != NULL) jf_reply_free(jf_net_await(replies[1]));
+
+    // resume markers of the other parts, as jf_playback_video_ticks_request
+    // and jf_playback_video_ticks_collect do
+    if (item->children_count > 1) {
+        url = jf_growing_buffer_scratch();
+        jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+        JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items?enableimages=false&ids=");
+        for (i = 1; i < item->children_count; i++) {
+            if (i > 1) JF_GROWING_BUFFER_APPEND_LITERAL(url, ",");
+            jf_growing_buffer_append(url, item->children[i]->id, 0);
+        }
+        parts = jf_net_request(jf_growing_buffer_cstr(url), JF_REQUEST_ASYNC_IN_MEMORY, JF_HTTP_GET, NULL);
+        jf_net_await(parts);
+        if (JF_REPLY_PTR_HAS_ERROR(parts)) {
+            fprintf(stderr, "FATAL: parts request failed: %s.\n", jf_reply_error_string(parts));
+            jf_exit(JF_EXIT_FAILURE);
+        }
+        if (jf_json_parse_parts_playback_ticks(item, parts->payload, NULL) != item->children_count - 1) {
+            fprintf(stderr, "FATAL: parts request did not return every part.\n");
+            jf_exit(JF_EXIT_FAILURE);
+        }
+        jf_reply_free(parts);
+    }
+
+    jf_menu_item_free(item);
+    return jf_bench_now() - start;
+}
+//////////////////////////////////
+
+
+////////// TLS //////////
+static void jf_bench_tls(const jf_mock_counters *counters, jf_bench_tls_checks *checks)
+{
+    struct pollfd done = { .fd = jf_net_async_done_fd(), .events = POLLIN };
+    jf_reply *replies[2];
+    uint64_t value;
+    size_t connections;
+    int i;
+
+    // the prewarm reply is kept by the net layer, but it is the only async
+    // request so far: the first completion is its own
+    jf_net_prewarm();
+    if (poll(&done, 1, JF_BENCH_TLS_TIMEOUT_MS) <= 0) {
+        fprintf(stderr, "FATAL: the prewarm request did not complete.\n");
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    if (read(done.fd, &value, sizeof(value)) == -1) {
+        fprintf(stderr, "FATAL: could not read the async done fd: %s.\n", strerror(errno));
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    if (atomic_load(&counters->requests) != 1) {
+        fprintf(stderr, "FATAL: the prewarm request never reached the mock server.\n");
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    connections = atomic_load(&counters->connections);
+
+    // synchronous, so on another handle than the prewarm's worker
+    replies[0] = jf_net_request("/system/info", JF_REQUEST_IN_MEMORY, JF_HTTP_GET, NULL);
+    if (JF_REPLY_PTR_HAS_ERROR(replies[0])) {
+        fprintf(stderr, "FATAL: request after prewarm failed: %s.\n", jf_reply_error_string(replies[0]));
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    jf_reply_free(replies[0]);
+    checks->prewarm_reused = connections == 1 && atomic_load(&counters->connections) == 1;
+
+    // neither can be answered before the other arrives, so the second
+    // cannot wait for the first's connection
+    for (i = 0; i < 2; i++) {
+        replies[i] = jf_net_request("/mock/barrier", JF_REQUEST_ASYNC_IN_MEMORY, JF_HTTP_GET, NULL);
+    }
+    for (i = 0; i < 2; i++) {
+        jf_net_await(replies[i]);
+        if (JF_REPLY_PTR_HAS_ERROR(replies[i])) {
+            fprintf(stderr, "FATAL: barrier request failed: %s.\n", jf_reply_error_string(replies[i]));
+            jf_exit(JF_EXIT_FAILURE);
+        }
+        jf_reply_free(replies[i]);
+    }
+    checks->session_resumed = atomic_load(&counters->handshakes) >= 2
+        && atomic_load(&counters->resumed_handshakes) >= 1;
+
+    checks->h2_offered = atomic_load(&counters->handshakes) > 0
+        && atomic_load(&counters->h2_offers) == atomic_load(&counters->handshakes);
+}
+/////////////////////////
+
+
+////////// REPORT //////////
+static int jf_bench_compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+static void jf_bench_print_metric(const char *name, double *samples, const size_t count, const bool last)
+{
+    size_t i;
+
+    qsort(samples, count, sizeof(double), jf_bench_compare_double);
+    fprintf(s_results, "    \"%s\": { \"min\": %.3f, \"median\": %.3f, \"max\": %.3f, \"samples\": [",
+            name, samples[0], samples[count / 2], samples[count - 1]);
+    for (i = 0; i < count; i++) {
+        fprintf(s_results, "%s%.3f", i == 0 ? "" : ", ", samples[i]);
+    }
+    fprintf(s_results, "] }%s\n", last ? "" : ",");
+}
+////////////////////////////
+
+
+int main(int argc, char *argv[])
+{
+    jf_mock_config config;
+    size_t runs = JF_BENCH_RUNS_DEFAULT, select = JF_BENCH_SELECT_DEFAULT, i;
+    char *server = NULL;
+    char runtime_dir[] = "/tmp/jftui-bench-XXXXXX";
+    char address[64];
+    double *samples[JF_BENCH_METRICS];
+    int listen_fd, stdout_fd, j;
+    pthread_t stdout_thread;
+    jf_bench_tls_checks tls_checks = { 0 };
+    bool tls_passed = true;
+
+    jf_mock_config_init(&config);
+    for (j = 1; j < argc; j++) {
+        if (jf_mock_config_parse_arg(&config, argc, argv, &j)) continue;
+        if (strcmp(argv[j], "--runs") == 0 && j + 1 < argc) {
+            runs = strtoul(argv[++j], NULL, 10);
+        } else if (strcmp(argv[j], "--select") == 0 && j + 1 < argc) {
+            select = strtoul(argv[++j], NULL, 10);
+        } else if (strcmp(argv[j], "--server") == 0 && j + 1 < argc) {
+            server = argv[++j];
+        } else {
+            fprintf(stderr, "FATAL: unrecognized argument %s.\n", argv[j]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (runs == 0) runs = 1;
+    // playback_start_single_part_ms needs the second item in the playlist
+    if (select < 2) select = 2;
+    if (config.tls && server != NULL) {
+        fprintf(stderr, "FATAL: --tls is for the forked mock server, not --server.\n");
+        return EXIT_FAILURE;
+    }
+
+    // MOCK SERVER
+    if (server == NULL) {
+        listen_fd = jf_mock_server_listen(&config);
+        if ((s_server_pid = fork()) == 0) {
+            jf_mock_server_run(listen_fd, &config);
+            _exit(EXIT_SUCCESS);
+        }
+        assert(s_server_pid > 0);
+        close(listen_fd);
+        snprintf(address, sizeof(address), "%s://127.0.0.1:%hu",
+                config.tls ? "https" : "http", config.port);
+        server = address;
+        if (config.tls) {
+            jf_net_set_cainfo(config.tls_ca_path);
+        }
+    }
+
+    // JFTUI STATE
+    // jf_options_init would drag in config.c and the whole menu with it
+    g_options = (jf_options){ 0 };
+    g_options.ssl_verifyhost = JF_CONFIG_SSL_VERIFYHOST_DEFAULT;
+    assert((g_options.server = strdup(server)) != NULL);
+    g_options.server_len = strlen(server);
+    assert((g_options.userid = strdup(JF_BENCH_USERID)) != NULL);
+    assert((g_options.token = strdup("bench")) != NULL);
+    g_options.user_prefix = jf_concat(2, "/users/", g_options.userid);
+    g_options.user_prefix_len = strlen(g_options.user_prefix);
+    g_state = (jf_global_state){ 0 };
+    g_state.state = JF_STATE_MENU_UI;
+    assert(mkdtemp(runtime_dir) != NULL);
+    g_state.runtime_dir = runtime_dir;
+    jf_disk_init();
+
+    // the parser prints every item: send that to a pipe, line buffered as
+    // on a terminal, and keep the real stdout for results
+    assert((stdout_fd = dup(STDOUT_FILENO)) != -1);
+    assert((s_results = fdopen(stdout_fd, "w")) != NULL);
+    assert(pipe(s_stdout_pipe) == 0);
+    assert(dup2(s_stdout_pipe[1], STDOUT_FILENO) != -1);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    assert(pthread_create(&stdout_thread, NULL, jf_bench_stdout_thread, NULL) == 0);
+
+    if (config.tls) {
+        jf_bench_tls(config.counters, &tls_checks);
+        tls_passed = tls_checks.prewarm_reused && tls_checks.session_resumed && tls_checks.h2_offered;
+    }
+
+    for (j = 0; j < JF_BENCH_METRICS; j++) {
+        assert((samples[j] = malloc(runs * sizeof(double))) != NULL);
+    }
+    for (i = 0; i < runs; i++) {
+        samples[1][i] = jf_bench_listing(samples[0] + i);
+        samples[2][i] = jf_bench_selector_to_playlist(select);
+        if (jf_disk_playlist_item_count() < 2) {
+            fprintf(stderr, "FATAL: the listing has fewer than two items.\n");
+            jf_exit(JF_EXIT_FAILURE);
+        }
+        samples[3][i] = jf_bench_playback_start(1);
+        samples[4][i] = jf_bench_playback_start(2);
+        jf_disk_refresh();
+    }
+
+    fprintf(s_results, "{\n  \"config\": { \"server\": \"%s\", \"items\": %zu, \"parts\": %zu, "
+            "\"latency_ms\": %ld, \"bandwidth_kbps\": %ld, \"select\": %zu, \"runs\": %zu },\n"
+            "  \"results\": {\n",
+            server, config.items, config.parts, config.latency_ms, config.bandwidth_kbps, select, runs);
+    jf_bench_print_metric("time_to_first_item_ms", samples[0], runs, false);
+    jf_bench_print_metric("listing_ms", samples[1], runs, false);
+    jf_bench_print_metric("selector_to_playlist_ms", samples[2], runs, false);
+    jf_bench_print_metric("playback_start_ms", samples[3], runs, false);
+    jf_bench_print_metric("playback_start_single_part_ms", samples[4], runs, true);
+    fprintf(s_results, "  },\n");
+    if (config.tls) {
+        fprintf(s_results, "  \"tls\": { \"prewarm_reused\": %s, \"session_resumed\": %s, \"h2_offered\": %s, "
+                "\"connections\": %zu, \"handshakes\": %zu, \"resumed_handshakes\": %zu, \"h2_offers\": %zu },\n",
+                tls_checks.prewarm_reused ? "true" : "false",
+                tls_checks.session_resumed ? "true" : "false",
+                tls_checks.h2_offered ? "true" : "false",
+                atomic_load(&config.counters->connections),
+                atomic_load(&config.counters->handshakes),
+                atomic_load(&config.counters->resumed_handshakes),
+                atomic_load(&config.counters->h2_offers));
+    }
+    fprintf(s_results, "  \"items_parsed\": %zu\n}\n", jf_thread_buffer_item_count());
+    fflush(s_results);
+
+    for (j = 0; j < JF_BENCH_METRICS; j++) {
+        free(samples[j]);
+    }
+    jf_disk_clear();
+    rmdir(runtime_dir);
+    if (s_server_pid > 0) {
+        kill(s_server_pid, SIGTERM);
+        waitpid(s_server_pid, NULL, 0);
+    }
+    if (config.tls) {
+        unlink(config.tls_ca_path);
+    }
+    if (! tls_passed) {
+        fprintf(stderr, "Error: TLS connection checks failed.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,666 @@
+#include "mock.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+
+////////// STATIC VARIABLES //////////
+static char *s_listing = NULL;
+static size_t s_listing_len = 0;
+// NULL unless config->tls
+static SSL_CTX *s_ssl_ctx = NULL;
+static pthread_mutex_t s_barrier_mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_barrier_cv = PTHREAD_COND_INITIALIZER;
+static size_t s_barrier_waiting = 0;
+static size_t s_barrier_generation = 0;
+//////////////////////////////////////
+
+
+////////// STATIC FUNCTIONS //////////
+static size_t jf_mock_item_parts(const char *id, const size_t parts);
+static char *jf_mock_render_item(const char *id, const size_t parts, size_t *len);
+static char *jf_mock_render_additional_parts(const char *id, const size_t parts, size_t *len);
+static char *jf_mock_render_items_by_id(const char *ids, size_t *len);
+static void jf_mock_render_listing(const size_t items, const size_t parts);
+
+// Generates a key and a self-signed certificate for 127.0.0.1, writes the
+// certificate to config->tls_ca_path and sets s_ssl_ctx up with them.
+// CAN FATAL.
+static void jf_mock_tls_init(jf_mock_config *config);
+
+// ALPN: counts offers of h2 in the jf_mock_counters at arg, picks http/1.1.
+static int jf_mock_tls_alpn_select(SSL *ssl,
+        const unsigned char **out,
+        unsigned char *outlen,
+        const unsigned char *in,
+        unsigned int inlen,
+        void *arg);
+
+// Returns:
+//  true once JF_MOCK_BARRIER_SIZE callers are in, false on timeout.
+static bool jf_mock_barrier(void);
+
+static void jf_mock_sleep_until(const struct timespec *start, const double seconds);
+// As recv, through TLS if the connection has it.
+static ssize_t jf_mock_recv(const jf_mock_connection *c, char *buf, const size_t len);
+static bool jf_mock_send(const jf_mock_connection *c, const char *buf, const size_t len);
+static bool jf_mock_respond(const jf_mock_connection *c,
+        const int status,
+        const char *body,
+        const size_t body_len);
+static bool jf_mock_route(const jf_mock_connection *c, const char *method, const char *path);
+
+static void *jf_mock_connection_thread(void *arg);
+//////////////////////////////////////
+
+
+////////// RESPONSES //////////
+#define JF_MOCK_ID_FORMAT "%032zx"
+#define JF_MOCK_ID_SIZE sizeof("0123456789abcdef0123456789abcdef")
+
+
+// Odd-numbered listing items are split in parts files, even-numbered ones are
+// a single file, so that both playback paths get exercised.
+static size_t jf_mock_item_parts(const char *id, const size_t parts)
+{
+    // ids are JF_MOCK_ID_FORMAT: the number fits in the low 16 digits
+    return strtoull(id + 16, NULL, 16) % 2 == 1 ? parts : 1;
+}
+
+
+static char *jf_mock_render_item(const char *id, const size_t parts, size_t *len)
+{
+    char *buf;
+    FILE *f;
+
+    assert((f = open_memstream(&buf, len)) != NULL);
+    fprintf(f, "{\"Name\":\"Movie %s\",\"Id\":\"%s\",\"Type\":\"Movie\","
+            "\"RunTimeTicks\":72000000000,",
+            id, id);
+    if (parts > 1) {
+        fprintf(f, "\"PartCount\":%zu,", parts);
+    }
+    fprintf(f, "\"UserData\":{\"PlaybackPositionTicks\":0,\"Played\":false},"
+            "\"MediaSources\":[{\"Id\":\"%s\",\"Name\":\"1080p\",\"MediaStreams\":["
+            "{\"Type\":\"Video\",\"Codec\":\"h264\",\"DisplayTitle\":\"1080p H264\",\"IsExternal\":false},"
+            "{\"Type\":\"Audio\",\"Codec\":\"aac\",\"DisplayTitle\":\"English AAC\",\"Language\":\"eng\",\"IsExternal\":false}"
+            "]}]}",
+            id);
+    assert(fclose(f) == 0);
+    return buf;
+}
+
+
+static char *jf_mock_render_additional_parts(const char *id, const size_t parts, size_t *len)
+{
+    char *buf, *item;
+    char part_id[JF_MOCK_ID_SIZE + 8];
+    size_t i, item_len;
+    FILE *f;
+
+    assert((f = open_memstream(&buf, len)) != NULL);
+    fputs("{\"Items\":[", f);
+    for (i = 1; i < parts; i++) {
+        snprintf(part_id, sizeof(part_id), "%.24s%08zx", id, i);
+        item = jf_mock_render_item(part_id, 1, &item_len);
+        fprintf(f, "%s%s", i == 1 ? "" : ",", item);
+        free(item);
+    }
+    fprintf(f, "],\"TotalRecordCount\":%zu}", parts - 1);
+    assert(fclose(f) == 0);
+    return buf;
+}
+
+
+// ids: the comma-separated value of the ids parameter, up to the end of the
+// query or the next parameter
+static char *jf_mock_render_items_by_id(const char *ids, size_t *len)
+{
+    char *buf, *item;
+    char id[JF_MOCK_ID_SIZE];
+    size_t count = 0, id_len, item_len;
+    FILE *f;
+
+    assert((f = open_memstream(&buf, len)) != NULL);
+    fputs("{\"Items\":[", f);
+    while (*ids != '\0' && *ids != '&') {
+        id_len = strspn(ids, "0123456789abcdef");
+        if (id_len == 32) {
+            snprintf(id, sizeof(id), "%.32s", ids);
+            item = jf_mock_render_item(id, 1, &item_len);
+            fprintf(f, "%s%s", count == 0 ? "" : ",", item);
+            free(item);
+            count++;
+        }
+        ids += id_len;
+        if (*ids == ',') {
+            ids++;
+        } else if (strncasecmp(ids, "%2c", 3) == 0) {
+            ids += 3;
+        } else if (*ids != '\0' && *ids != '&') {
+            // garbage: skip to the next separator
+            ids++;
+        }
+    }
+    fprintf(f, "],\"TotalRecordCount\":%zu,\"StartIndex\":0}", count);
+    assert(fclose(f) == 0);
+    return buf;
+}
+
+
+static void jf_mock_render_listing(const size_t items, const size_t parts)
+{
+    size_t i;
+    char part_count[64];
+    FILE *f;
+
+    assert((f = open_memstream(&s_listing, &s_listing_len)) != NULL);
+    fputs("{\"Items\":[", f);
+    for (i = 0; i < items; i++) {
+        // same rule as jf_mock_item_parts, the number being i + 1
+        part_count[0] = '\0';
+        if ((i + 1) % 2 == 1 && parts > 1) {
+            snprintf(part_count, sizeof(part_count), "\"PartCount\":%zu,", parts);
+        }
+        fprintf(f, "%s{\"Name\":\"Synthetic movie number %zu\",\"ServerId\":\"mock\","
+                "\"Id\":\"" JF_MOCK_ID_FORMAT "\",\"HasSubtitles\":true,\"Container\":\"mkv\","
+                "\"PremiereDate\":\"2001-01-01T00:00:00.0000000Z\",\"CriticRating\":80,"
+                "\"OfficialRating\":\"PG-13\",\"CommunityRating\":7.1,"
+                "\"RunTimeTicks\":%zu,\"ProductionYear\":%zu,\"IsFolder\":false,\"Type\":\"Movie\","
+                "%s"
+                "\"UserData\":{\"PlaybackPositionTicks\":%zu,\"PlayCount\":0,\"IsFavorite\":false,"
+                "\"Played\":false,\"Key\":\"%zu\"},"
+                "\"PrimaryImageAspectRatio\":0.6666666666666666,\"VideoType\":\"VideoFile\","
+                "\"ImageTags\":{\"Primary\":\"0123456789abcdef\"},\"BackdropImageTags\":[],"
+                "\"LocationType\":\"FileSystem\",\"MediaType\":\"Video\"}",
+                i == 0 ? "" : ",",
+                i + 1,
+                i + 1,
+                (size_t)60000000000 + i,
+                1950 + i % 70,
+                part_count,
+                i % 7 == 0 ? (size_t)3000000000 : 0,
+                i);
+    }
+    fprintf(f, "],\"TotalRecordCount\":%zu,\"StartIndex\":0}", items);
+    assert(fclose(f) == 0);
+}
+///////////////////////////////
+
+
+////////// TLS //////////
+static void jf_mock_tls_init(jf_mock_config *config)
+{
+    EVP_PKEY_CTX *key_ctx;
+    EVP_PKEY *key = NULL;
+    X509 *cert;
+    X509_NAME *name;
+    X509V3_CTX ext_ctx;
+    X509_EXTENSION *ext;
+    FILE *pem;
+    int fd;
+    size_t i;
+    const struct { int nid; char *value; } extensions[] = {
+        { NID_basic_constraints, "critical,CA:TRUE" },
+        { NID_subject_key_identifier, "hash" },
+        { NID_subject_alt_name, "IP:127.0.0.1,DNS:localhost" }
+    };
+
+    // key
+    assert((key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL)) != NULL);
+    assert(EVP_PKEY_keygen_init(key_ctx) == 1);
+    assert(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx, NID_X9_62_prime256v1) == 1);
+    assert(EVP_PKEY_keygen(key_ctx, &key) == 1);
+    EVP_PKEY_CTX_free(key_ctx);
+
+    // certificate, its own issuer
+    assert((cert = X509_new()) != NULL);
+    assert(X509_set_version(cert, 2) == 1);
+    assert(ASN1_INTEGER_set(X509_get_serialNumber(cert), 1) == 1);
+    assert(X509_gmtime_adj(X509_getm_notBefore(cert), -3600) != NULL);
+    assert(X509_gmtime_adj(X509_getm_notAfter(cert), 86400) != NULL);
+    assert(X509_set_pubkey(cert, key) == 1);
+    name = X509_get_subject_name(cert);
+    assert(X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                (const unsigned char *)"jftui mock", -1, -1, 0) == 1);
+    assert(X509_set_issuer_name(cert, name) == 1);
+    X509V3_set_ctx_nodb(&ext_ctx);
+    X509V3_set_ctx(&ext_ctx, cert, cert, NULL, NULL, 0);
+    for (i = 0; i < sizeof(extensions) / sizeof(*extensions); i++) {
+        assert((ext = X509V3_EXT_conf_nid(NULL, &ext_ctx, extensions[i].nid, extensions[i].value)) != NULL);
+        assert(X509_add_ext(cert, ext, -1) == 1);
+        X509_EXTENSION_free(ext);
+    }
+    assert(X509_sign(cert, key, EVP_sha256()) > 0);
+
+    // for clients
+    snprintf(config->tls_ca_path, sizeof(config->tls_ca_path), "/tmp/jftui-mock-ca-XXXXXX.pem");
+    if ((fd = mkstemps(config->tls_ca_path, 4)) == -1) {
+        fprintf(stderr, "FATAL: could not create %s: %s.\n", config->tls_ca_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    assert((pem = fdopen(fd, "w")) != NULL);
+    assert(PEM_write_X509(pem, cert) == 1);
+    assert(fclose(pem) == 0);
+
+    // for us; session resumption works out of the box, both through the
+    // server's session cache and TLS 1.3 tickets
+    assert((s_ssl_ctx = SSL_CTX_new(TLS_server_method())) != NULL);
+    assert(SSL_CTX_use_certificate(s_ssl_ctx, cert) == 1);
+    assert(SSL_CTX_use_PrivateKey(s_ssl_ctx, key) == 1);
+    SSL_CTX_set_alpn_select_cb(s_ssl_ctx, jf_mock_tls_alpn_select, config->counters);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+
+static int jf_mock_tls_alpn_select(__attribute__((unused)) SSL *ssl,
+        const unsigned char **out,
+        unsigned char *outlen,
+        const unsigned char *in,
+        unsigned int inlen,
+        void *arg)
+{
+    jf_mock_counters *counters = (jf_mock_counters *)arg;
+    const unsigned char *http_1_1 = NULL;
+    unsigned int i;
+
+    // a list of length-prefixed protocol names
+    for (i = 0; i < inlen && i + 1 + in[i] <= inlen; i += 1 + in[i]) {
+        if (in[i] == 2 && memcmp(in + i + 1, "h2", 2) == 0) {
+            atomic_fetch_add(&counters->h2_offers, 1);
+        } else if (in[i] == 8 && memcmp(in + i + 1, "http/1.1", 8) == 0) {
+            http_1_1 = in + i + 1;
+        }
+    }
+    if (http_1_1 == NULL) return SSL_TLSEXT_ERR_NOACK;
+    *out = http_1_1;
+    *outlen = 8;
+    return SSL_TLSEXT_ERR_OK;
+}
+/////////////////////////
+
+
+////////// HTTP //////////
+static bool jf_mock_barrier(void)
+{
+    struct timespec deadline;
+    size_t generation;
+    bool released = true;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += JF_MOCK_BARRIER_TIMEOUT_SECS;
+
+    pthread_mutex_lock(&s_barrier_mut);
+    generation = s_barrier_generation;
+    if (++s_barrier_waiting == JF_MOCK_BARRIER_SIZE) {
+        s_barrier_waiting = 0;
+        s_barrier_generation++;
+        pthread_cond_broadcast(&s_barrier_cv);
+    } else {
+        while (generation == s_barrier_generation) {
+            if (pthread_cond_timedwait(&s_barrier_cv, &s_barrier_mut, &deadline) == ETIMEDOUT) {
+                s_barrier_waiting--;
+                released = false;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&s_barrier_mut);
+
+    return released;
+}
+
+
+static void jf_mock_sleep_until(const struct timespec *start, const double seconds)
+{
+    struct timespec deadline;
+    long nsec;
+
+    deadline.tv_sec = start->tv_sec + (time_t)seconds;
+    nsec = start->tv_nsec + (long)((seconds - (double)(time_t)seconds) * 1e9);
+    deadline.tv_sec += nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        // again
+    }
+}
+
+
+static ssize_t jf_mock_recv(const jf_mock_connection *c, char *buf, const size_t len)
+{
+    if (c->ssl != NULL) {
+        return SSL_read(c->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    }
+    return recv(c->fd, buf, len, 0);
+}
+
+
+static bool jf_mock_send(const jf_mock_connection *c, const char *buf, const size_t len)
+{
+    size_t sent = 0;
+    ssize_t n;
+
+    while (sent < len) {
+        if (c->ssl != NULL) {
+            // whole writes only, unless SSL_MODE_ENABLE_PARTIAL_WRITE
+            if (SSL_write(c->ssl, buf + sent, len - sent > INT_MAX ? INT_MAX : (int)(len - sent)) <= 0) {
+                return false;
+            }
+            sent += len - sent > INT_MAX ? INT_MAX : len - sent;
+            continue;
+        }
+        if ((n = send(c->fd, buf + sent, len - sent, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+
+static bool jf_mock_respond(const jf_mock_connection *c,
+        const int status,
+        const char *body,
+        const size_t body_len)
+{
+    char header[256];
+    int header_len;
+    size_t sent, chunk;
+    struct timespec start;
+
+    header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 %d %s\r\n"
+            "Content-Type: application/json; charset=utf-8\r\n"
+            "Content-Length: %zu\r\n"
+            "\r\n",
+            status,
+            status == 200 ? "OK" : status == 204 ? "No Content" : "Not Found",
+            body_len);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (c->config->latency_ms > 0) {
+        jf_mock_sleep_until(&start, (double)c->config->latency_ms / 1e3);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    if (! jf_mock_send(c, header, (size_t)header_len)) return false;
+
+    for (sent = 0; sent < body_len; sent += chunk) {
+        chunk = body_len - sent < JF_MOCK_SEND_CHUNK_SIZE ? body_len - sent : JF_MOCK_SEND_CHUNK_SIZE;
+        if (! jf_mock_send(c, body + sent, chunk)) return false;
+        if (c->config->bandwidth_kbps > 0) {
+            jf_mock_sleep_until(&start,
+                    (double)(sent + chunk) * 8 / ((double)c->config->bandwidth_kbps * 1e3));
+        }
+    }
+    return true;
+}
+
+
+static bool jf_mock_route(const jf_mock_connection *c, const char *method, const char *path)
+{
+    char *body = NULL;
+    size_t body_len = 0;
+    const char *rest, *ids;
+    char id[JF_MOCK_ID_SIZE];
+    bool result;
+
+    atomic_fetch_add(&c->config->counters->requests, 1);
+
+    if (strcmp(method, "GET") != 0) {
+        // progress reports, played marks...
+        return jf_mock_respond(c, 204, "", 0);
+    }
+
+    if (strncmp(path, "/mock/barrier", 13) == 0) {
+        return jf_mock_barrier() ? jf_mock_respond(c, 200, "{}", 2)
+            : jf_mock_respond(c, 404, "", 0);
+    }
+
+    if (strncmp(path, "/system/info", 12) == 0) {
+        return jf_mock_respond(c, 200,
+                "{\"ServerName\":\"jftui mock\",\"Version\":\"10.8.0\",\"Id\":\"mock\"}",
+                strlen("{\"ServerName\":\"jftui mock\",\"Version\":\"10.8.0\",\"Id\":\"mock\"}"));
+    }
+
+    if (strncmp(path, "/videos/", 8) == 0 && strstr(path, "/additionalparts") != NULL) {
+        snprintf(id, sizeof(id), "%.32s", path + 8);
+        body = jf_mock_render_additional_parts(id, jf_mock_item_parts(id, c->config->parts), &body_len);
+    } else if (strncmp(path, "/users/", 7) == 0 && (rest = strchr(path + 7, '/')) != NULL) {
+        if (strncmp(rest, "/views", 6) == 0) {
+            const char views[] = "{\"Items\":["
+                "{\"Name\":\"Movies\",\"Id\":\"00000000000000000000000000000001\",\"Type\":\"CollectionFolder\",\"CollectionType\":\"movies\"},"
+                "{\"Name\":\"Shows\",\"Id\":\"00000000000000000000000000000002\",\"Type\":\"CollectionFolder\",\"CollectionType\":\"tvshows\"},"
+                "{\"Name\":\"Music\",\"Id\":\"00000000000000000000000000000003\",\"Type\":\"CollectionFolder\",\"CollectionType\":\"music\"}"
+                "],\"TotalRecordCount\":3}";
+            return jf_mock_respond(c, 200, views, sizeof(views) - 1);
+        } else if (strncmp(rest, "/items/", 7) == 0
+                && strspn(rest + 7, "0123456789abcdef") == 32
+                && (rest[39] == '\0' || rest[39] == '?')) {
+            snprintf(id, sizeof(id), "%.32s", rest + 7);
+            body = jf_mock_render_item(id, jf_mock_item_parts(id, c->config->parts), &body_len);
+        } else if (strncmp(rest, "/items?", 7) == 0
+                && ((ids = strstr(rest, "?ids=")) != NULL || (ids = strstr(rest, "&ids=")) != NULL)) {
+            // user data of split-file parts, all at once
+            body = jf_mock_render_items_by_id(ids + 5, &body_len);
+        } else {
+            return jf_mock_respond(c, 200, s_listing, s_listing_len);
+        }
+    } else if (strncmp(path, "/shows/nextup", 13) == 0 || strncmp(path, "/artists", 8) == 0) {
+        return jf_mock_respond(c, 200, s_listing, s_listing_len);
+    } else {
+        return jf_mock_respond(c, 404, "", 0);
+    }
+
+    result = jf_mock_respond(c, 200, body, body_len);
+    free(body);
+    return result;
+}
+
+
+static void *jf_mock_connection_thread(void *arg)
+{
+    jf_mock_connection *c = (jf_mock_connection *)arg;
+    char buf[65536];
+    char method[16], path[8192];
+    size_t used = 0, request_len, content_length;
+    char *end, *cl;
+    ssize_t n;
+
+    if (s_ssl_ctx != NULL) {
+        assert((c->ssl = SSL_new(s_ssl_ctx)) != NULL);
+        assert(SSL_set_fd(c->ssl, c->fd) == 1);
+        if (SSL_accept(c->ssl) != 1) goto close;
+        atomic_fetch_add(&c->config->counters->handshakes, 1);
+        if (SSL_session_reused(c->ssl)) {
+            atomic_fetch_add(&c->config->counters->resumed_handshakes, 1);
+        }
+    }
+
+    while (true) {
+        // read a full request head
+        buf[used] = '\0';
+        while ((end = strstr(buf, "\r\n\r\n")) == NULL) {
+            if (used == sizeof(buf) - 1) goto close;
+            if ((n = jf_mock_recv(c, buf + used, sizeof(buf) - 1 - used)) <= 0) goto close;
+            used += (size_t)n;
+            buf[used] = '\0';
+        }
+        request_len = (size_t)(end - buf) + 4;
+
+        content_length = 0;
+        *end = '\0';
+        for (cl = strstr(buf, "\r\n"); cl != NULL; cl = strstr(cl + 2, "\r\n")) {
+            if (strncasecmp(cl + 2, "content-length:", 15) == 0) {
+                content_length = strtoul(cl + 17, NULL, 10);
+                break;
+            }
+        }
+        if (sscanf(buf, "%15s %8191s", method, path) != 2) goto close;
+
+        // discard the body, if any
+        while (used < request_len + content_length) {
+            if (used == sizeof(buf) - 1) {
+                // only the part past the head matters from now on
+                content_length -= used - request_len;
+                used = request_len;
+            }
+            if ((n = jf_mock_recv(c, buf + used, sizeof(buf) - 1 - used)) <= 0) goto close;
+            used += (size_t)n;
+        }
+        request_len += content_length;
+
+        if (! jf_mock_route(c, method, path)) goto close;
+
+        // keep pipelined leftovers
+        memmove(buf, buf + request_len, used - request_len);
+        used -= request_len;
+    }
+
+close:
+    if (c->ssl != NULL) {
+        SSL_shutdown(c->ssl);
+        SSL_free(c->ssl);
+    }
+    close(c->fd);
+    free(c);
+    return NULL;
+}
+//////////////////////////
+
+
+////////// MOCK SERVER //////////
+void jf_mock_config_init(jf_mock_config *config)
+{
+    config->port = 0;
+    config->latency_ms = 0;
+    config->bandwidth_kbps = 0;
+    config->items = JF_MOCK_ITEMS_DEFAULT;
+    config->parts = JF_MOCK_PARTS_DEFAULT;
+    config->tls = false;
+    config->tls_ca_path[0] = '\0';
+    // shared, so that it survives a fork with both sides seeing the same
+    if ((config->counters = mmap(NULL, sizeof(jf_mock_counters),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        fprintf(stderr, "FATAL: could not map the mock server counters: %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&config->counters->connections, 0);
+    atomic_init(&config->counters->requests, 0);
+    atomic_init(&config->counters->handshakes, 0);
+    atomic_init(&config->counters->resumed_handshakes, 0);
+    atomic_init(&config->counters->h2_offers, 0);
+}
+
+
+bool jf_mock_config_parse_arg(jf_mock_config *config, const int argc, char *argv[], int *i)
+{
+    const char *arg = argv[*i];
+    unsigned long value;
+
+    if (strcmp(arg, "--tls") == 0) {
+        config->tls = true;
+        return true;
+    }
+    if (strcmp(arg, "--port") != 0
+            && strcmp(arg, "--latency-ms") != 0
+            && strcmp(arg, "--bandwidth-kbps") != 0
+            && strcmp(arg, "--items") != 0
+            && strcmp(arg, "--parts") != 0) {
+        return false;
+    }
+    if (++(*i) >= argc) {
+        fprintf(stderr, "FATAL: missing parameter for argument %s.\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    value = strtoul(argv[*i], NULL, 10);
+
+    if (strcmp(arg, "--port") == 0) {
+        config->port = (unsigned short)value;
+    } else if (strcmp(arg, "--latency-ms") == 0) {
+        config->latency_ms = (long)value;
+    } else if (strcmp(arg, "--bandwidth-kbps") == 0) {
+        config->bandwidth_kbps = (long)value;
+    } else if (strcmp(arg, "--items") == 0) {
+        config->items = value;
+    } else {
+        config->parts = value == 0 ? 1 : value;
+    }
+    return true;
+}
+
+
+int jf_mock_server_listen(jf_mock_config *config)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int fd, one = 1;
+
+    jf_mock_render_listing(config->items, config->parts);
+    if (config->tls) {
+        jf_mock_tls_init(config);
+    }
+
+    assert((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+    assert(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(config->port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        fprintf(stderr, "FATAL: mock server could not listen on port %hu: %s.\n",
+                config->port, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    assert(getsockname(fd, (struct sockaddr *)&addr, &addr_len) == 0);
+    config->port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+
+void jf_mock_server_run(const int listen_fd, const jf_mock_config *config)
+{
+    jf_mock_connection *c;
+    pthread_t thread;
+    int fd, one = 1;
+
+    // SSL_write has no MSG_NOSIGNAL: a client hanging up must not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    while (true) {
+        if ((fd = accept(listen_fd, NULL, NULL)) == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "FATAL: mock server accept: %s.\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        atomic_fetch_add(&config->counters->connections, 1);
+        assert((c = malloc(sizeof(jf_mock_connection))) != NULL);
+        c->fd = fd;
+        c->ssl = NULL;
+        c->config = config;
+        assert(pthread_create(&thread, NULL, jf_mock_connection_thread, c) == 0);
+        assert(pthread_detach(thread) == 0);
+    }
+}
+/////////////////////////////////
@@ -0,0 +1,114 @@
+#ifndef _JF_BENCH_MOCK
+#define _JF_BENCH_MOCK
+
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <openssl/ssl.h>
+
+
+// Minimal HTTP/1.1 stand-in for a Jellyfin server, for benchmarks only.
+//
+// It answers the handful of endpoints jftui hits while browsing and starting
+// playback with synthesised responses:
+//  - /system/info
+//  - /users/<id>/views
+//  - /users/<id>/items/<id> (a movie: odd-numbered ones are split in `parts`
+//      files, even-numbered ones are a single file)
+//  - /users/<id>/items?ids=<id>,<id>...: those items, as single-part movies
+//  - /videos/<id>/additionalparts
+//  - any other /users/<id>/items..., /shows/nextup, /artists: a listing of
+//      `items` movies, with PartCount on the split ones
+//  - /mock/barrier: held until JF_MOCK_BARRIER_SIZE requests wait on it
+//      (or JF_MOCK_BARRIER_TIMEOUT_SECS pass, then 404), so that they are
+//      sure to come over as many connections
+//  - POST and DELETE anything: 204
+// Connections are kept alive; each one is served by its own thread.
+//
+// With --tls it speaks HTTPS instead, with a self-signed certificate for
+// 127.0.0.1 generated on the spot. ALPN always settles on http/1.1: whether
+// the client offered h2 is counted, but HTTP/2 itself is not spoken.
+
+
+////////// CONSTANTS //////////
+#define JF_MOCK_ITEMS_DEFAULT 100000
+#define JF_MOCK_PARTS_DEFAULT 3
+#define JF_MOCK_SEND_CHUNK_SIZE 16384
+#define JF_MOCK_BARRIER_SIZE 2
+#define JF_MOCK_BARRIER_TIMEOUT_SECS 5
+///////////////////////////////
+
+
+////////// MOCK SERVER //////////
+// What the server has seen so far. Kept in shared memory, so that a process
+// forking the server off can read them.
+typedef struct jf_mock_counters {
+    atomic_size_t connections;
+    atomic_size_t requests;
+    // TLS only
+    atomic_size_t handshakes;
+    atomic_size_t resumed_handshakes;
+    // handshakes where the client offered h2 through ALPN
+    atomic_size_t h2_offers;
+} jf_mock_counters;
+
+
+typedef struct jf_mock_config {
+    // 0 lets the kernel pick
+    unsigned short port;
+    // delay before the first byte of each response
+    long latency_ms;
+    // throughput cap for response bodies, 0 is unlimited
+    long bandwidth_kbps;
+    size_t items;
+    size_t parts;
+    bool tls;
+    // with tls, filled by jf_mock_server_listen: PEM file of the certificate
+    // for clients to trust
+    char tls_ca_path[64];
+    jf_mock_counters *counters;
+} jf_mock_config;
+
+
+typedef struct jf_mock_connection {
+    int fd;
+    // NULL for plain HTTP
+    SSL *ssl;
+    const jf_mock_config *config;
+} jf_mock_connection;
+
+
+// Fills config with defaults: ephemeral port, no latency, unlimited
+// bandwidth, no TLS. Maps fresh counters.
+// CAN FATAL.
+void jf_mock_config_init(jf_mock_config *config);
+
+
+// Consumes argv[*i] (and its parameter) if it is one of --port,
+// --latency-ms, --bandwidth-kbps, --items, --parts, --tls (no parameter).
+//
+// Returns:
+//  true if the argument was recognized.
+// CAN FATAL.
+bool jf_mock_config_parse_arg(jf_mock_config *config, const int argc, char *argv[], int *i);
+
+
+// Binds a listening socket on 127.0.0.1 and pre-renders the listing. With
+// config->tls, also generates the certificate and writes it to a temporary
+// file in config->tls_ca_path: the caller removes it.
+//
+// Parameters:
+//  - config: settings; config->port is updated with the actual port.
+//
+// Returns:
+//  The listening socket.
+// CAN FATAL.
+int jf_mock_server_listen(jf_mock_config *config);
+
+
+// Accepts and serves connections forever.
+// CAN FATAL.
+void jf_mock_server_run(const int listen_fd, const jf_mock_config *config);
+/////////////////////////////////
+#endif
@@ -0,0 +1,37 @@
+// Standalone mock Jellyfin server, see mock.h.
+//
+// Usage: bench_mock_server [--port N] [--latency-ms N] [--bandwidth-kbps N]
+//                          [--items N] [--parts N] [--tls]
+
+#include "mock.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+int main(int argc, char *argv[])
+{
+    jf_mock_config config;
+    int i, fd;
+
+    jf_mock_config_init(&config);
+    config.port = 8096;
+    for (i = 1; i < argc; i++) {
+        if (! jf_mock_config_parse_arg(&config, argc, argv, &i)) {
+            fprintf(stderr, "FATAL: unrecognized argument %s.\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    fd = jf_mock_server_listen(&config);
+    printf("Mock server listening on %s://127.0.0.1:%hu (%zu items, %zu parts).\n",
+            config.tls ? "https" : "http", config.port, config.items, config.parts);
+    if (config.tls) {
+        printf("Its certificate is in %s.\n", config.tls_ca_path);
+    }
+    fflush(stdout);
+    jf_mock_server_run(fd, &config);
+
+    return EXIT_SUCCESS;
+}
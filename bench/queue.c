@@ -0,0 +1,285 @@
+// Stress benchmark for jf_synced_queue.
+//
+// N producers push items through the queue to M consumers. Each run is
+// repeated against the mutex + condvar ring jftui used to ship with, the
+// lock-free queue in blocking mode and the lock-free queue in overflow mode.
+// Consumers check that nothing got lost and that items from any single
+// producer reach them in order.
+//
+// Usage: bench_queue [producers] [consumers] [items per producer] [slots]
+
+#include "../src/shared.h"
+#include "../src/config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+
+////////// GLOBAL VARIABLES //////////
+// shared.c wants these; nothing here touches them
+jf_options g_options;
+jf_global_state g_state;
+mpv_handle *g_mpv_ctx = NULL;
+
+void jf_exit(int sig)
+{
+    exit(sig);
+}
+//////////////////////////////////////
+
+
+////////// BASELINE QUEUE //////////
+// verbatim the old jf_synced_queue
+typedef struct jf_mutex_queue {
+    const void **slots;
+    size_t slot_count;
+    size_t current;
+    size_t next;
+    pthread_mutex_t mut;
+    pthread_cond_t cv_is_empty;
+    pthread_cond_t cv_is_full;
+} jf_mutex_queue;
+
+
+static jf_mutex_queue *jf_mutex_queue_new(const size_t slots)
+{
+    jf_mutex_queue *q;
+
+    assert((q = malloc(sizeof(jf_mutex_queue))) != NULL);
+    assert((q->slots = calloc(slots, sizeof(void *))) != NULL);
+    q->slot_count = slots;
+    q->current = 0;
+    q->next = 0;
+    assert(pthread_mutex_init(&q->mut, NULL) == 0);
+    assert(pthread_cond_init(&q->cv_is_empty, NULL) == 0);
+    assert(pthread_cond_init(&q->cv_is_full, NULL) == 0);
+    return q;
+}
+
+
+static void jf_mutex_queue_free(jf_mutex_queue *q)
+{
+    free(q->slots);
+    free(q);
+}
+
+
+static void jf_mutex_queue_enqueue(jf_mutex_queue *q, const void *payload)
+{
+    pthread_mutex_lock(&q->mut);
+    while (q->slots[q->next] != NULL) {
+        pthread_cond_wait(&q->cv_is_full, &q->mut);
+    }
+    q->slots[q->next] = payload;
+    q->next = (q->next + 1) % q->slot_count;
+    pthread_mutex_unlock(&q->mut);
+    pthread_cond_signal(&q->cv_is_empty);
+}
+
+
+static void *jf_mutex_queue_dequeue(jf_mutex_queue *q)
+{
+    void *payload;
+
+    pthread_mutex_lock(&q->mut);
+    while (q->slots[q->current] == NULL) {
+        pthread_cond_wait(&q->cv_is_empty, &q->mut);
+    }
+    payload = (void *)q->slots[q->current];
+    q->slots[q->current] = NULL;
+    q->current = (q->current + 1) % q->slot_count;
+    pthread_mutex_unlock(&q->mut);
+    pthread_cond_signal(&q->cv_is_full);
+
+    return payload;
+}
+////////////////////////////////////
+
+
+////////// HARNESS //////////
+#define JF_BENCH_STOP ((void *)UINTPTR_MAX)
+#define JF_BENCH_ITEM(_p, _i) ((void *)(((uintptr_t)(_p) << 32) | ((uintptr_t)(_i) + 1)))
+#define JF_BENCH_ITEM_PRODUCER(_v) ((size_t)((uintptr_t)(_v) >> 32))
+#define JF_BENCH_ITEM_INDEX(_v) ((size_t)(((uintptr_t)(_v) & 0xffffffff) - 1))
+
+
+typedef enum jf_bench_kind {
+    JF_BENCH_MUTEX,
+    JF_BENCH_LOCKFREE,
+    JF_BENCH_LOCKFREE_OVERFLOW
+} jf_bench_kind;
+
+
+typedef struct jf_bench_run {
+    jf_bench_kind kind;
+    jf_mutex_queue *mutex_queue;
+    jf_synced_queue *queue;
+    size_t producers;
+    size_t items;
+    pthread_barrier_t start;
+} jf_bench_run;
+
+
+typedef struct jf_bench_thread {
+    jf_bench_run *run;
+    size_t id;
+    size_t received;
+    bool in_order;
+} jf_bench_thread;
+
+
+static inline void jf_bench_enqueue(jf_bench_run *run, const void *payload)
+{
+    if (run->kind == JF_BENCH_MUTEX) {
+        jf_mutex_queue_enqueue(run->mutex_queue, payload);
+    } else {
+        jf_synced_queue_enqueue(run->queue, payload);
+    }
+}
+
+
+static inline void *jf_bench_dequeue(jf_bench_run *run)
+{
+    return run->kind == JF_BENCH_MUTEX ? jf_mutex_queue_dequeue(run->mutex_queue)
+        : jf_synced_queue_dequeue(run->queue);
+}
+
+
+static void *jf_bench_producer(void *arg)
+{
+    jf_bench_thread *t = (jf_bench_thread *)arg;
+    size_t i;
+
+    pthread_barrier_wait(&t->run->start);
+    for (i = 0; i < t->run->items; i++) {
+        jf_bench_enqueue(t->run, JF_BENCH_ITEM(t->id, i));
+    }
+    return NULL;
+}
+
+
+static void *jf_bench_consumer(void *arg)
+{
+    jf_bench_thread *t = (jf_bench_thread *)arg;
+    size_t *last;
+    size_t producer, index;
+    void *item;
+
+    assert((last = calloc(t->run->producers, sizeof(size_t))) != NULL);
+    pthread_barrier_wait(&t->run->start);
+    while ((item = jf_bench_dequeue(t->run)) != JF_BENCH_STOP) {
+        producer = JF_BENCH_ITEM_PRODUCER(item);
+        index = JF_BENCH_ITEM_INDEX(item) + 1;
+        if (producer >= t->run->producers || index <= last[producer]) {
+            t->in_order = false;
+        } else {
+            last[producer] = index;
+        }
+        t->received++;
+    }
+    free(last);
+    return NULL;
+}
+
+
+static double jf_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static bool jf_bench(const jf_bench_kind kind,
+        const size_t producers,
+        const size_t consumers,
+        const size_t items,
+        const size_t slots)
+{
+    jf_bench_run run;
+    jf_bench_thread *threads;
+    pthread_t *tids;
+    size_t i, received = 0;
+    bool in_order = true;
+    double start, elapsed;
+
+    run.kind = kind;
+    run.mutex_queue = kind == JF_BENCH_MUTEX ? jf_mutex_queue_new(slots) : NULL;
+    run.queue = kind == JF_BENCH_MUTEX ? NULL
+        : jf_synced_queue_new(slots, kind == JF_BENCH_LOCKFREE_OVERFLOW);
+    run.producers = producers;
+    run.items = items;
+    assert(pthread_barrier_init(&run.start, NULL, (unsigned)(producers + consumers + 1)) == 0);
+
+    assert((threads = calloc(producers + consumers, sizeof(jf_bench_thread))) != NULL);
+    assert((tids = malloc((producers + consumers) * sizeof(pthread_t))) != NULL);
+    for (i = 0; i < producers + consumers; i++) {
+        threads[i].run = &run;
+        threads[i].id = i;
+        threads[i].in_order = true;
+        assert(pthread_create(tids + i,
+                    NULL,
+                    i < producers ? jf_bench_producer : jf_bench_consumer,
+                    threads + i) == 0);
+    }
+
+    pthread_barrier_wait(&run.start);
+    start = jf_bench_now();
+    for (i = 0; i < producers; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    for (i = 0; i < consumers; i++) {
+        jf_bench_enqueue(&run, JF_BENCH_STOP);
+    }
+    for (i = producers; i < producers + consumers; i++) {
+        pthread_join(tids[i], NULL);
+        received += threads[i].received;
+        in_order = in_order && threads[i].in_order;
+    }
+    elapsed = jf_bench_now() - start;
+
+    printf("%-18s %3zu -> %-3zu %10.3f ms %12.0f items/s%s%s\n",
+            kind == JF_BENCH_MUTEX ? "mutex+condvar"
+                : kind == JF_BENCH_LOCKFREE ? "lock-free" : "lock-free overflow",
+            producers, consumers,
+            elapsed * 1e3,
+            (double)(producers * items) / elapsed,
+            received == producers * items ? "" : " LOST ITEMS",
+            in_order ? "" : " OUT OF ORDER");
+
+    pthread_barrier_destroy(&run.start);
+    free(threads);
+    free(tids);
+    if (run.mutex_queue != NULL) jf_mutex_queue_free(run.mutex_queue);
+    jf_synced_queue_free(run.queue);
+
+    return received == producers * items && in_order;
+}
+/////////////////////////////
+
+
+int main(int argc, char *argv[])
+{
+    size_t producers = 4, consumers = 4, items = 1000000, slots = 16;
+    bool ok = true;
+
+    if (argc > 1) producers = strtoul(argv[1], NULL, 10);
+    if (argc > 2) consumers = strtoul(argv[2], NULL, 10);
+    if (argc > 3) items = strtoul(argv[3], NULL, 10);
+    if (argc > 4) slots = strtoul(argv[4], NULL, 10);
+    if (producers == 0 || consumers == 0 || slots < 2 || items >= UINT32_MAX) {
+        fprintf(stderr, "Usage: %s [producers] [consumers] [items per producer] [slots >= 2]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu items per producer, %zu slots\n", items, slots);
+    ok = jf_bench(JF_BENCH_MUTEX, producers, consumers, items, slots) && ok;
+    ok = jf_bench(JF_BENCH_LOCKFREE, producers, consumers, items, slots) && ok;
+    ok = jf_bench(JF_BENCH_LOCKFREE_OVERFLOW, producers, consumers, items, slots) && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
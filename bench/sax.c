@@ -0,0 +1,326 @@
+// SAX parser throughput benchmark.
+//
+// Feeds an /items style JSON document through jf_json_sax_thread exactly the
+// way jf_thread_buffer_callback does during a JF_REQUEST_SAX_PROMISCUOUS
+// request, parsed items landing in the disk cache through
+// jf_disk_payload_add_record. The document is either synthesised or read from
+// a file (e.g. a recorded server response).
+//
+// Reports MB/s, items/s and heap allocations per item (malloc, calloc and
+// realloc calls made by any thread while parsing). The per-item lines the
+// parser prints go to /dev/null; results go to stdout.
+//
+// Usage: bench_sax [--items N] [--richness 0|1|2] [--chunk BYTES]
+//                  [--repeat N] [--file PATH]
+//  richness: 0 only the fields jftui reads, 1 a default /items DTO,
+//      2 a DTO requested with extra Fields (overview, people, genres...)
+
+#include "../src/shared.h"
+#include "../src/config.h"
+#include "../src/json.h"
+#include "../src/disk.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+
+////////// CONSTANTS //////////
+#define JF_BENCH_ITEMS_DEFAULT 100000
+#define JF_BENCH_RICHNESS_DEFAULT 1
+#define JF_BENCH_REPEAT_DEFAULT 5
+// same slicing as jf_thread_buffer_callback
+#define JF_BENCH_CHUNK_DEFAULT (JF_THREAD_BUFFER_DATA_SIZE - 2)
+///////////////////////////////
+
+
+////////// GLOBAL VARIABLES //////////
+jf_options g_options;
+jf_global_state g_state;
+mpv_handle *g_mpv_ctx = NULL;
+//////////////////////////////////////
+
+
+////////// STATIC VARIABLES //////////
+static jf_thread_buffer s_tb;
+static atomic_bool s_count_allocations = false;
+static atomic_size_t s_allocations = 0;
+//////////////////////////////////////
+
+
+////////// STATIC FUNCTIONS //////////
+static char *jf_bench_render(const size_t items, const int richness, size_t *len);
+static char *jf_bench_read_file(const char *path, size_t *len);
+static bool jf_bench_feed(const char *json, const size_t len, const size_t chunk);
+static double jf_bench_now(void);
+//////////////////////////////////////
+
+
+////////// STUBS //////////
+void jf_exit(int sig)
+{
+    jf_disk_clear();
+    _exit(sig);
+}
+
+
+size_t jf_menu_user_ask_selection(const size_t l, __attribute__((unused)) const size_t r)
+{
+    return l;
+}
+///////////////////////////
+
+
+////////// ALLOCATION COUNTING //////////
+// glibc lets the application replace its allocator; we forward to it
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+
+void *malloc(size_t size)
+{
+    if (atomic_load_explicit(&s_count_allocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&s_allocations, 1, memory_order_relaxed);
+    }
+    return __libc_malloc(size);
+}
+
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (atomic_load_explicit(&s_count_allocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&s_allocations, 1, memory_order_relaxed);
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+    if (atomic_load_explicit(&s_count_allocations, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&s_allocations, 1, memory_order_relaxed);
+    }
+    return __libc_realloc(ptr, size);
+}
+/////////////////////////////////////////
+
+
+////////// INPUT //////////
+static char *jf_bench_render(const size_t items, const int richness, size_t *len)
+{
+    char *buf;
+    size_t i;
+    int p;
+    FILE *f;
+
+    assert((f = open_memstream(&buf, len)) != NULL);
+    fputs("{\"Items\":[", f);
+    for (i = 0; i < items; i++) {
+        fprintf(f, "%s{\"Name\":\"Synthetic episode number %zu\",\"Id\":\"%032zx\",\"Type\":\"Episode\","
+                "\"SeriesName\":\"Synthetic series %zu\",\"IndexNumber\":%zu,\"ParentIndexNumber\":%zu,"
+                "\"RunTimeTicks\":%zu,\"ProductionYear\":%zu,"
+                "\"UserData\":{\"PlaybackPositionTicks\":%zu",
+                i == 0 ? "" : ",",
+                i + 1, i + 1, i / 100, i % 100 + 1, i / 10 % 10 + 1,
+                (size_t)26000000000 + i, 1950 + i % 70,
+                i % 7 == 0 ? (size_t)3000000000 : 0);
+        if (richness >= 1) {
+            fprintf(f, ",\"PlayCount\":0,\"IsFavorite\":false,\"Played\":false,\"Key\":\"%zu\"}", i);
+            fprintf(f, ",\"ServerId\":\"0123456789abcdef0123456789abcdef\",\"HasSubtitles\":true,"
+                    "\"Container\":\"mkv\",\"PremiereDate\":\"2001-01-01T00:00:00.0000000Z\","
+                    "\"CommunityRating\":7.1,\"IsFolder\":false,\"SeriesId\":\"%032zx\","
+                    "\"SeasonId\":\"%032zx\",\"PrimaryImageAspectRatio\":1.7777777777777777,"
+                    "\"VideoType\":\"VideoFile\",\"ImageTags\":{\"Primary\":\"0123456789abcdef\"},"
+                    "\"BackdropImageTags\":[],\"ParentBackdropImageTags\":[\"0123456789abcdef\"],"
+                    "\"LocationType\":\"FileSystem\",\"MediaType\":\"Video\"",
+                    i / 100, i / 10);
+        } else {
+            fputc('}', f);
+        }
+        if (richness >= 2) {
+            fputs(",\"Overview\":\"A synthetic overview long enough to look like the real thing: "
+                    "somebody goes somewhere, something happens, and nothing is quite the same "
+                    "afterwards. Will they make it back in time for the season finale?\","
+                    "\"Genres\":[\"Drama\",\"Mystery\",\"Science Fiction\"],"
+                    "\"Studios\":[{\"Name\":\"Synthetic Studio\",\"Id\":\"00000000000000000000000000000001\"}],"
+                    "\"ProviderIds\":{\"Tvdb\":\"123456\",\"Imdb\":\"tt0123456\",\"TvRage\":\"1234\"},"
+                    "\"People\":[", f);
+            for (p = 0; p < 6; p++) {
+                fprintf(f, "%s{\"Name\":\"Actor %d\",\"Id\":\"%032x\",\"Role\":\"Character %d\","
+                        "\"Type\":\"Actor\",\"PrimaryImageTag\":\"0123456789abcdef\"}",
+                        p == 0 ? "" : ",", p, p, p);
+            }
+            fputs("],\"Chapters\":[{\"StartPositionTicks\":0,\"Name\":\"Chapter 1\"},"
+                    "{\"StartPositionTicks\":6000000000,\"Name\":\"Chapter 2\"}]", f);
+        }
+        fputc('}', f);
+    }
+    fprintf(f, "],\"TotalRecordCount\":%zu,\"StartIndex\":0}", items);
+    assert(fclose(f) == 0);
+    return buf;
+}
+
+
+static char *jf_bench_read_file(const char *path, size_t *len)
+{
+    char *buf;
+    FILE *f;
+    long size;
+
+    if ((f = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "FATAL: could not open %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    assert(fseek(f, 0, SEEK_END) == 0);
+    assert((size = ftell(f)) >= 0);
+    rewind(f);
+    assert((buf = malloc((size_t)size + 1)) != NULL);
+    assert(fread(buf, 1, (size_t)size, f) == (size_t)size);
+    buf[size] = '\0';
+    fclose(f);
+    *len = (size_t)size;
+    return buf;
+}
+///////////////////////////
+
+
+////////// PARSING //////////
+// Mirrors jf_thread_buffer_callback followed by
+// jf_thread_buffer_wait_parsing_done.
+static bool jf_bench_feed(const char *json, const size_t len, const size_t chunk)
+{
+    size_t written = 0, chunk_size;
+
+    pthread_mutex_lock(&s_tb.mut);
+    while (written < len) {
+        while (s_tb.state == JF_THREAD_BUFFER_STATE_PENDING_DATA) {
+            pthread_cond_wait(&s_tb.cv_has_data, &s_tb.mut);
+        }
+        if (s_tb.state == JF_THREAD_BUFFER_STATE_PARSER_ERROR) {
+            fprintf(stderr, "Error: %s.\n", s_tb.data);
+            s_tb.state = JF_THREAD_BUFFER_STATE_CLEAR;
+            pthread_mutex_unlock(&s_tb.mut);
+            return false;
+        }
+        chunk_size = len - written < chunk ? len - written : chunk;
+        memcpy(s_tb.data, json + written, chunk_size);
+        written += chunk_size;
+        s_tb.data[chunk_size + 1] = '\0';
+        s_tb.used = chunk_size;
+        s_tb.state = JF_THREAD_BUFFER_STATE_PENDING_DATA;
+        pthread_cond_signal(&s_tb.cv_no_data);
+    }
+    while (s_tb.state == JF_THREAD_BUFFER_STATE_PENDING_DATA) {
+        pthread_cond_wait(&s_tb.cv_has_data, &s_tb.mut);
+    }
+    // still AWAITING_DATA means the document was truncated
+    if (s_tb.state != JF_THREAD_BUFFER_STATE_CLEAR) {
+        fprintf(stderr, "Error: %s.\n",
+                s_tb.state == JF_THREAD_BUFFER_STATE_PARSER_ERROR ? s_tb.data : "truncated JSON document");
+        s_tb.state = JF_THREAD_BUFFER_STATE_CLEAR;
+        pthread_mutex_unlock(&s_tb.mut);
+        return false;
+    }
+    pthread_mutex_unlock(&s_tb.mut);
+    return true;
+}
+
+
+static double jf_bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+/////////////////////////////
+
+
+int main(int argc, char *argv[])
+{
+    size_t items = JF_BENCH_ITEMS_DEFAULT, chunk = JF_BENCH_CHUNK_DEFAULT;
+    size_t repeat = JF_BENCH_REPEAT_DEFAULT, len, parsed, allocations, r;
+    int richness = JF_BENCH_RICHNESS_DEFAULT, i, results_fd;
+    const char *path = NULL;
+    char runtime_dir[] = "/tmp/jftui-bench-XXXXXX";
+    char *json;
+    double start, elapsed, best = 0;
+    pthread_t sax_thread;
+    FILE *results;
+
+    for (i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "FATAL: missing parameter for argument %s.\n", argv[i]);
+            return EXIT_FAILURE;
+        } else if (strcmp(argv[i], "--items") == 0) {
+            items = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--richness") == 0) {
+            richness = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--chunk") == 0) {
+            chunk = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            repeat = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--file") == 0) {
+            path = argv[++i];
+        } else {
+            fprintf(stderr, "FATAL: unrecognized argument %s.\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (chunk == 0 || chunk > JF_THREAD_BUFFER_DATA_SIZE - 2) chunk = JF_BENCH_CHUNK_DEFAULT;
+    if (repeat == 0) repeat = 1;
+
+    json = path == NULL ? jf_bench_render(items, richness, &len) : jf_bench_read_file(path, &len);
+
+    g_options = (jf_options){ 0 };
+    g_state = (jf_global_state){ 0 };
+    g_state.state = JF_STATE_MENU_UI;
+    assert(mkdtemp(runtime_dir) != NULL);
+    g_state.runtime_dir = runtime_dir;
+    jf_disk_init();
+
+    // parser output is part of the cost, but not of the report
+    assert((results_fd = dup(STDOUT_FILENO)) != -1);
+    assert((results = fdopen(results_fd, "w")) != NULL);
+    assert(freopen("/dev/null", "w", stdout) != NULL);
+
+    jf_thread_buffer_init(&s_tb);
+    s_tb.promiscuous_context = true;
+    assert(pthread_create(&sax_thread, NULL, jf_json_sax_thread, &s_tb) == 0);
+    assert(pthread_detach(sax_thread) == 0);
+
+    fprintf(results, "%s: %.2f MB, chunk %zu bytes\n",
+            path == NULL ? "synthetic" : path, (double)len / 1e6, chunk);
+    for (r = 0; r < repeat; r++) {
+        // as jf_menu_ui does before every listing
+        jf_disk_payload_refresh();
+        atomic_store(&s_allocations, 0);
+        atomic_store(&s_count_allocations, true);
+        start = jf_bench_now();
+        if (! jf_bench_feed(json, len, chunk)) {
+            return EXIT_FAILURE;
+        }
+        elapsed = jf_bench_now() - start;
+        atomic_store(&s_count_allocations, false);
+        allocations = atomic_load(&s_allocations);
+        parsed = s_tb.item_count;
+        if (best == 0 || elapsed < best) best = elapsed;
+
+        fprintf(results, "run %zu: %8.2f MB/s %10.0f items/s %6.2f allocations/item (%zu items)\n",
+                r + 1,
+                (double)len / 1e6 / elapsed,
+                (double)parsed / elapsed,
+                parsed == 0 ? 0.0 : (double)allocations / (double)parsed,
+                parsed);
+    }
+    fprintf(results, "best: %.2f MB/s\n", (double)len / 1e6 / best);
+
+    free(json);
+    jf_disk_clear();
+    rmdir(runtime_dir);
+    return EXIT_SUCCESS;
+}
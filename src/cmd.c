@@ -352,7 +352,7 @@ YY_ACTION(void) yy_1_num(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_1_num\n"));
   {
-#line 84
+#line 85
    __ = strtoul(yytext, NULL, 10); ;
   }
 #undef yythunkpos
@@ -369,7 +369,7 @@ YY_ACTION(void) yy_2_Atom(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_2_Atom\n"));
   {
-#line 83
+#line 84
    yy_cmd_digest(yy, n); ;
   }
 #undef yythunkpos
@@ -389,7 +389,7 @@ YY_ACTION(void) yy_1_Atom(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_1_Atom\n"));
   {
-#line 82
+#line 83
    yy_cmd_digest_range(yy, l, r); ;
   }
 #undef yythunkpos
@@ -406,13 +406,27 @@ YY_ACTION(void) yy_1_Selector(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_1_Selector\n"));
   {
-#line 78
+#line 79
    yy_cmd_digest_range(yy, 1, jf_menu_child_count()); ;
   }
 #undef yythunkpos
 #undef yypos
 #undef yy
 }
+YY_ACTION(void) yy_6_Start(yycontext *yy, char *yytext, int yyleng)
+{
+#define __ yy->__
+#define yypos yy->__pos
+#define yythunkpos yy->__thunkpos
+  yyprintf((stderr, "do yy_6_Start\n"));
+  {
+#line 78
+   yy_cmd_finalize(yy, true); ;
+  }
+#undef yythunkpos
+#undef yypos
+#undef yy
+}
 YY_ACTION(void) yy_5_Start(yycontext *yy, char *yytext, int yyleng)
 {
 #define __ yy->__
@@ -420,8 +434,8 @@ YY_ACTION(void) yy_5_Start(yycontext *yy, char *yytext, int yyleng)
 #define yythunkpos yy->__thunkpos
   yyprintf((stderr, "do yy_5_Start\n"));
   {
-#line 77
-   yy_cmd_finalize(yy, true); ;
+#line 76
+   yy->state = JF_CMD_SPECIAL; jf_menu_stats(); ;
   }
 #undef yythunkpos
 #undef yypos
@@ -604,24 +618,25 @@ if (!(YY_END)) goto l28;
 #undef yyleng
   }  yyDo(yy, yy_3_Start, yy->__begin, yy->__end);  goto l25;
   l28:;	  yy->__pos= yypos25; yy->__thunkpos= yythunkpos25;  if (!yymatchChar(yy, 'q')) goto l33;  yyDo(yy, yy_4_Start, yy->__begin, yy->__end);  goto l25;
-  l33:;	  yy->__pos= yypos25; yy->__thunkpos= yythunkpos25;  if (!yy_Selector(yy)) goto l22;
+  l33:;	  yy->__pos= yypos25; yy->__thunkpos= yythunkpos25;  if (!yymatchString(yy, "stats")) goto l34;  yyDo(yy, yy_5_Start, yy->__begin, yy->__end);  goto l25;
+  l34:;	  yy->__pos= yypos25; yy->__thunkpos= yythunkpos25;  if (!yy_Selector(yy)) goto l22;
   }
   l25:;	
-  l34:;	
-  {  int yypos35= yy->__pos, yythunkpos35= yy->__thunkpos;  if (!yy_ws(yy)) goto l35;  goto l34;
-  l35:;	  yy->__pos= yypos35; yy->__thunkpos= yythunkpos35;
+  l35:;	
+  {  int yypos36= yy->__pos, yythunkpos36= yy->__thunkpos;  if (!yy_ws(yy)) goto l36;  goto l35;
+  l36:;	  yy->__pos= yypos36; yy->__thunkpos= yythunkpos36;
   }
-  {  int yypos38= yy->__pos, yythunkpos38= yy->__thunkpos;  if (!yymatchDot(yy)) goto l38;  goto l37;
-  l38:;	  yy->__pos= yypos38; yy->__thunkpos= yythunkpos38;
-  }  goto l36;
-  l37:;	  yyText(yy, yy->__begin, yy->__end);  {
+  {  int yypos39= yy->__pos, yythunkpos39= yy->__thunkpos;  if (!yymatchDot(yy)) goto l39;  goto l38;
+  l39:;	  yy->__pos= yypos39; yy->__thunkpos= yythunkpos39;
+  }  goto l37;
+  l38:;	  yyText(yy, yy->__begin, yy->__end);  {
 #define yytext yy->__text
 #define yyleng yy->__textlen
    yy_cmd_finalize(yy, false); ;
 #undef yytext
 #undef yyleng
   }  goto l22;
-  l36:;	  yyDo(yy, yy_5_Start, yy->__begin, yy->__end);
+  l37:;	  yyDo(yy, yy_6_Start, yy->__begin, yy->__end);
   yyprintf((stderr, "  ok   %s @ %s\n", "Start", yy->__buf+yy->__pos));
   return 1;
   l22:;	  yy->__pos= yypos0; yy->__thunkpos= yythunkpos0;
@@ -676,7 +691,7 @@ YY_PARSE(yycontext *) YYRELEASE(yycontext *yyctx)
 }
 
 #endif
-#line 90 "src/cmd.leg"
+#line 91 "src/cmd.leg"
 
 jf_cmd_parser_state yy_cmd_get_parser_state(const yycontext *ctx)
 {
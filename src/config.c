@@ -23,6 +23,10 @@ extern jf_global_state g_state;
 // Will fill in fields client, device, deviceid and version of the global
 // options struct, unless they're already filled in.
 static void jf_options_complete_with_defaults(void);
+
+
+// Recomputes the user_prefix field of the global options struct from userid.
+static void jf_options_update_user_prefix(void);
 //////////////////////////////////////
 
 
@@ -50,6 +54,18 @@ static void jf_options_complete_with_defaults()
 }
 
 
+static void jf_options_update_user_prefix()
+{
+    free(g_options.user_prefix);
+    g_options.user_prefix = NULL;
+    g_options.user_prefix_len = 0;
+    if (g_options.userid == NULL) return;
+
+    g_options.user_prefix = jf_concat(2, "/users/", g_options.userid);
+    g_options.user_prefix_len = strlen(g_options.user_prefix);
+}
+
+
 void jf_options_init(void)
 {
     g_options = (jf_options){ 0 };
@@ -66,6 +82,7 @@ void jf_options_clear()
     free(g_options.server);
     free(g_options.token);
     free(g_options.userid);
+    free(g_options.user_prefix);
     free(g_options.client);
     free(g_options.version);
 }
@@ -146,6 +163,7 @@ void jf_config_read(const char *config_path)
 
     // apply defaults for missing values
     jf_options_complete_with_defaults();
+    jf_options_update_user_prefix();
 
     free(line);
     fclose(config_file);
@@ -258,6 +276,7 @@ void jf_config_ask_user_login()
     }
     printf("Login successful.\n");
     jf_json_parse_login_response(login_reply->payload);
+    jf_options_update_user_prefix();
     jf_reply_free(login_reply);
     jf_growing_buffer_free(password);
 }
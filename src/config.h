@@ -52,6 +52,9 @@ typedef struct jf_options {
     size_t server_len;
     char *token;
     char *userid;
+    // "/users/<userid>", computed once as most request URLs start with it
+    char *user_prefix;
+    size_t user_prefix_len;
     bool ssl_verifyhost;
     char *client;
     char device[JF_CONFIG_DEVICE_SIZE];
@@ -1,17 +1,23 @@
 #include "disk.h"
 #include "shared.h"
 #include "menu.h"
+#include "stats.h"
+#include "config.h"
 
 #include <stdlib.h> // malloc, getenv
 #include <stdio.h> // fwrite etc.
 #include <unistd.h> // unlink
 #include <sys/stat.h> //mkdir
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <assert.h>
+#include <pthread.h>
 
 
 ////////// GLOBALS //////////
 extern jf_global_state g_state;
+extern jf_options g_options;
 /////////////////////////////
 
 
@@ -19,85 +25,304 @@ extern jf_global_state g_state;
 static jf_growing_buffer *s_buffer = NULL;
 static jf_file_cache s_payload = (jf_file_cache){ 0 };
 static jf_file_cache s_playlist = (jf_file_cache){ 0 };
+// serialized records for s_playlist, main thread only
+static jf_growing_buffer *s_write_buffer = NULL;
+
+// s_payload records are serialized by the parser thread into pending and
+// written out by jf_disk_payload_writer_thread, which swaps it with writing.
+// Offsets and lengths in s_payload are assigned when the record is staged.
+static struct {
+    pthread_mutex_t mut;
+    // wakes the writer
+    pthread_cond_t cv_work;
+    // pending is empty and the writer is not writing
+    pthread_cond_t cv_idle;
+    jf_growing_buffer *pending;
+    jf_growing_buffer *writing;
+    bool flush_requested;
+    bool busy;
+} s_staging = {
+    .mut = PTHREAD_MUTEX_INITIALIZER,
+    .cv_work = PTHREAD_COND_INITIALIZER,
+    .cv_idle = PTHREAD_COND_INITIALIZER
+};
+
+// guards the position of s_payload.body, shared by the writer and readers
+static pthread_mutex_t s_payload_io_mut = PTHREAD_MUTEX_INITIALIZER;
+
+// subtitle files, kept across sessions
+static char *s_subtitles_dir = NULL;
 //////////////////////////////////////
 
 
 ////////// STATIC FUNCTIONS ///////////
 static inline void jf_disk_align_to(jf_file_cache *cache, const size_t n);
 static inline void jf_disk_open(jf_file_cache *cache);
-static void jf_disk_add_next(jf_file_cache *cache, const jf_menu_item *item);
+// Appends item and its children to buffer.
+// Returns the number of bytes appended.
+// CAN FATAL.
+static size_t jf_disk_serialize(jf_growing_buffer *buffer, const jf_menu_item *item);
+
+// Appends a single record header, as in the serialization of an item with
+// the given fields. children_count records are expected to follow.
+// id must be at least JF_ID_LENGTH long or \0-terminated.
+// CAN FATAL.
+static inline void jf_disk_serialize_record(jf_growing_buffer *buffer,
+        const jf_item_type type,
+        const char *id,
+        const char *name,
+        const size_t name_length,
+        const long long runtime_ticks,
+        const long long playback_ticks,
+        const size_t part_count,
+        const bool played,
+        const size_t children_count);
+
+// Call with s_staging.mut held, after appending a record of length bytes to
+// s_staging.pending: indexes it and wakes the writer if enough is staged.
+static void jf_disk_payload_staged(const size_t length);
+
+static size_t jf_disk_add_next(jf_file_cache *cache, const jf_menu_item *item);
 static void jf_disk_add_item(jf_file_cache *cache, const jf_menu_item *item);
-static jf_menu_item *jf_disk_get_next(jf_file_cache *cache);
+// Reads the item at the current position of cache->body, adding the stdio
+// calls it took to calls.
+static jf_menu_item *jf_disk_get_next(jf_file_cache *cache, size_t *calls);
 static jf_menu_item *jf_disk_get_item(jf_file_cache *cache, const size_t n);
+
+// Rewrites body with only the live records, in index order, and swaps it in
+// place of the old one with a rename.
+// CAN FATAL.
+static void jf_disk_compact(jf_file_cache *cache);
+
+static void *jf_disk_payload_writer_thread(void *arg);
+
+// Blocks until everything staged for s_payload is in its body.
+// CAN'T FAIL.
+static void jf_disk_payload_sync(void);
+
+// Path of the cached copy of the subtitle file at resource, named after a
+// hash of the server address and resource and keeping its extension (mpv
+// tells the format by it).
+// CAN FATAL.
+static char *jf_disk_subtitle_path(const char *resource);
 ///////////////////////////////////////
 
 
 static inline void jf_disk_open(jf_file_cache *cache)
 {
-    assert((cache->header = fopen(cache->header_path, "w+")) != NULL);
     assert((cache->body = fopen(cache->body_path, "w+")) != NULL);
+    if (cache->offsets == NULL) {
+        cache->offsets_size = JF_DISK_BUFFER_SIZE;
+        assert((cache->offsets = malloc(cache->offsets_size * sizeof(long))) != NULL);
+        assert((cache->lengths = malloc(cache->offsets_size * sizeof(size_t))) != NULL);
+    }
     cache->count = 0;
+    cache->live_bytes = 0;
+    cache->dead_bytes = 0;
 }
 
 
 static inline void
 jf_disk_align_to(jf_file_cache *cache, const size_t n)
 {
-    long body_offset;
-    assert(fseek(cache->header, (long)((n - 1) * sizeof(long)), SEEK_SET) == 0);
-    assert(fread(&body_offset, sizeof(long), 1, cache->header) == 1);
-    assert(fseek(cache->body, body_offset, SEEK_SET) == 0);
+    assert(fseek(cache->body, cache->offsets[n - 1], SEEK_SET) == 0);
 }
 
 
-static void jf_disk_add_next(jf_file_cache *cache, const jf_menu_item *item)
+static inline void jf_disk_serialize_record(jf_growing_buffer *buffer,
+        const jf_item_type type,
+        const char *id,
+        const char *name,
+        const size_t name_length,
+        const long long runtime_ticks,
+        const long long playback_ticks,
+        const size_t part_count,
+        const bool played,
+        const size_t children_count)
 {
-    size_t name_length, i;
+    char id_field[JF_ID_LENGTH + 1] = { 0 };
 
-    assert(fwrite(&(item->type), sizeof(jf_item_type), 1, cache->body) == 1);
-    assert(fwrite(item->id, 1, sizeof(item->id), cache->body) == sizeof(item->id));
-    name_length = item->name == NULL ? 0 : strlen(item->name);
-    assert(fwrite(item->name, 1, name_length, cache->body) == name_length);
-    assert(fwrite(&"\0", 1, 1, cache->body) == 1);
-    assert(fwrite(&(item->runtime_ticks), sizeof(long long), 1, cache->body) == 1);
-    assert(fwrite(&(item->playback_ticks), sizeof(long long), 1, cache->body) == 1);
-    assert(fwrite(&(item->children_count), sizeof(size_t), 1, cache->body) == 1);
+    if (id != NULL) {
+        strncpy(id_field, id, JF_ID_LENGTH);
+    }
+    jf_growing_buffer_append(buffer, &type, sizeof(jf_item_type));
+    jf_growing_buffer_append(buffer, id_field, sizeof(id_field));
+    jf_growing_buffer_append(buffer, name, name_length);
+    jf_growing_buffer_append(buffer, "", 1);
+    jf_growing_buffer_append(buffer, &runtime_ticks, sizeof(long long));
+    jf_growing_buffer_append(buffer, &playback_ticks, sizeof(long long));
+    jf_growing_buffer_append(buffer, &part_count, sizeof(size_t));
+    jf_growing_buffer_append(buffer, &played, sizeof(bool));
+    jf_growing_buffer_append(buffer, &children_count, sizeof(size_t));
+}
+
+
+static size_t jf_disk_serialize(jf_growing_buffer *buffer, const jf_menu_item *item)
+{
+    size_t i, starting_used = buffer->used;
+
+    jf_disk_serialize_record(buffer,
+            item->type,
+            item->id,
+            item->name,
+            item->name == NULL ? 0 : strlen(item->name),
+            item->runtime_ticks,
+            item->playback_ticks,
+            item->part_count,
+            item->played,
+            item->children_count);
     for (i = 0; i < item->children_count; i++) {
-        jf_disk_add_next(cache, item->children[i]);
+        jf_disk_serialize(buffer, item->children[i]);
     }
+    return buffer->used - starting_used;
+}
+
+
+// Returns the number of bytes written.
+static size_t jf_disk_add_next(jf_file_cache *cache, const jf_menu_item *item)
+{
+    jf_growing_buffer_empty(s_write_buffer);
+    jf_disk_serialize(s_write_buffer, item);
+    assert(fwrite(s_write_buffer->buf, 1, s_write_buffer->used, cache->body) == s_write_buffer->used);
+    return s_write_buffer->used;
 }
 
 
 static void jf_disk_add_item(jf_file_cache *cache, const jf_menu_item *item)
 {
     long starting_body_offset;
+    uint64_t start_us = jf_stats_now_us();
 
     assert(item != NULL);
 
-    assert(fseek(cache->header, 0, SEEK_END) == 0);
     assert(fseek(cache->body, 0, SEEK_END) == 0);
     assert((starting_body_offset = ftell(cache->body)) != -1);
-    assert(fwrite(&starting_body_offset, sizeof(long), 1, cache->header) == 1);
-
-    jf_disk_add_next(cache, item);
+    if (cache->count == cache->offsets_size) {
+        cache->offsets_size *= 2;
+        assert((cache->offsets = realloc(cache->offsets,
+                        cache->offsets_size * sizeof(long))) != NULL);
+        assert((cache->lengths = realloc(cache->lengths,
+                        cache->offsets_size * sizeof(size_t))) != NULL);
+    }
+    cache->offsets[cache->count] = starting_body_offset;
+
+    cache->lengths[cache->count] = jf_disk_add_next(cache, item);
+    cache->live_bytes += cache->lengths[cache->count];
+    jf_stats_disk_record(JF_STATS_DISK_WRITE,
+            cache->lengths[cache->count],
+            1,
+            jf_stats_now_us() - start_us);
     cache->count++;
 }
 
 
-static void jf_disk_read_to_null_to_buffer(jf_file_cache *cache)
+static void jf_disk_compact(jf_file_cache *cache)
 {
-    char tmp;
+    FILE *compacted;
+    char *compacted_path;
+    char chunk[4096];
+    size_t i, left, chunk_size, calls = 0;
+    long offset = 0;
+    uint64_t start_us = jf_stats_now_us();
+
+    assert((compacted_path = jf_concat(2, cache->body_path, ".compact")) != NULL);
+    assert((compacted = fopen(compacted_path, "w+")) != NULL);
+    for (i = 0; i < cache->count; i++) {
+        jf_disk_align_to(cache, i + 1);
+        for (left = cache->lengths[i]; left > 0; left -= chunk_size) {
+            chunk_size = left < sizeof(chunk) ? left : sizeof(chunk);
+            assert(fread(chunk, 1, chunk_size, cache->body) == chunk_size);
+            assert(fwrite(chunk, 1, chunk_size, compacted) == chunk_size);
+            calls += 2;
+        }
+        cache->offsets[i] = offset;
+        offset += (long)cache->lengths[i];
+    }
+    assert(fflush(compacted) == 0);
+    // the new body takes the old one's name in one step, so there is never
+    // a moment where body_path holds a partial file
+    assert(rename(compacted_path, cache->body_path) == 0);
+    assert(fclose(cache->body) == 0);
+    cache->body = compacted;
+    free(compacted_path);
+
+    jf_stats_disk_record(JF_STATS_DISK_COMPACT,
+            (size_t)offset,
+            calls,
+            jf_stats_now_us() - start_us);
+    cache->dead_bytes = 0;
+}
 
-    jf_growing_buffer_empty(s_buffer);
+
+static void *jf_disk_payload_writer_thread(__attribute__((unused)) void *arg)
+{
+    jf_growing_buffer *tmp;
+    uint64_t start_us;
+
+    pthread_mutex_lock(&s_staging.mut);
     while (true) {
-        assert(fread(&tmp, 1, 1, cache->body) == 1);
-        jf_growing_buffer_append(s_buffer, &tmp, 1);
-        if (tmp == '\0') break;
+        while (! (s_staging.flush_requested && s_staging.pending->used > 0)) {
+            s_staging.flush_requested = false;
+            pthread_cond_wait(&s_staging.cv_work, &s_staging.mut);
+        }
+        tmp = s_staging.writing;
+        s_staging.writing = s_staging.pending;
+        s_staging.pending = tmp;
+        s_staging.flush_requested = false;
+        s_staging.busy = true;
+        pthread_mutex_unlock(&s_staging.mut);
+
+        // the parser keeps staging into pending meanwhile
+        start_us = jf_stats_now_us();
+        pthread_mutex_lock(&s_payload_io_mut);
+        assert(fseek(s_payload.body, 0, SEEK_END) == 0);
+        assert(fwrite(s_staging.writing->buf, 1, s_staging.writing->used, s_payload.body)
+                == s_staging.writing->used);
+        assert(fflush(s_payload.body) == 0);
+        pthread_mutex_unlock(&s_payload_io_mut);
+        jf_stats_disk_record(JF_STATS_DISK_WRITE,
+                s_staging.writing->used,
+                1,
+                jf_stats_now_us() - start_us);
+
+        pthread_mutex_lock(&s_staging.mut);
+        jf_growing_buffer_empty(s_staging.writing);
+        s_staging.busy = false;
+        pthread_cond_broadcast(&s_staging.cv_idle);
     }
+    return NULL;
 }
 
 
-static jf_menu_item *jf_disk_get_next(jf_file_cache *cache)
+static void jf_disk_payload_sync(void)
+{
+    pthread_mutex_lock(&s_staging.mut);
+    while (s_staging.pending->used > 0 || s_staging.busy) {
+        // asked again every round in case more got staged meanwhile
+        if (s_staging.pending->used > 0) {
+            s_staging.flush_requested = true;
+            pthread_cond_signal(&s_staging.cv_work);
+        }
+        pthread_cond_wait(&s_staging.cv_idle, &s_staging.mut);
+    }
+    pthread_mutex_unlock(&s_staging.mut);
+}
+
+
+static void jf_disk_read_to_null_to_buffer(jf_file_cache *cache)
+{
+    ssize_t read_bytes;
+
+    // getdelim will grow the buffer through realloc as needed
+    assert((read_bytes = getdelim(&s_buffer->buf,
+                    &s_buffer->size,
+                    '\0',
+                    cache->body)) > 0);
+    s_buffer->used = (size_t)read_bytes;
+}
+
+
+static jf_menu_item *jf_disk_get_next(jf_file_cache *cache, size_t *calls)
 {
     jf_menu_item *item;
     size_t i;
@@ -110,11 +335,15 @@ static jf_menu_item *jf_disk_get_next(jf_file_cache *cache)
     item->name = strdup(s_buffer->buf);
     assert(fread(&(item->runtime_ticks), sizeof(long long), 1, cache->body) == 1);
     assert(fread(&(item->playback_ticks), sizeof(long long), 1, cache->body) == 1);
+    assert(fread(&(item->part_count), sizeof(size_t), 1, cache->body) == 1);
+    assert(fread(&(item->played), sizeof(bool), 1, cache->body) == 1);
     assert(fread(&(item->children_count), sizeof(size_t), 1, cache->body) == 1);
+    // the seven freads and the getdelim above
+    *calls += 8;
     if (item->children_count > 0) {
         assert((item->children = malloc(item->children_count * sizeof(jf_menu_item *))) != NULL);
         for (i = 0; i < item->children_count; i++) {
-            item->children[i] = jf_disk_get_next(cache);
+            item->children[i] = jf_disk_get_next(cache, calls);
         }
     } else {
         item->children = NULL;
@@ -126,10 +355,21 @@ static jf_menu_item *jf_disk_get_next(jf_file_cache *cache)
 
 static jf_menu_item *jf_disk_get_item(jf_file_cache *cache, const size_t n)
 {
+    jf_menu_item *item;
+    size_t calls = 0;
+    uint64_t start_us;
+
     if (n == 0 || n > cache->count) return NULL;
 
+    start_us = jf_stats_now_us();
     jf_disk_align_to(cache, n);
-    return jf_disk_get_next(cache);
+    item = jf_disk_get_next(cache, &calls);
+    // a record is read whole, children included
+    jf_stats_disk_record(JF_STATS_DISK_READ,
+            cache->lengths[n - 1],
+            calls,
+            jf_stats_now_us() - start_us);
+    return item;
 }
 
 
@@ -159,15 +399,12 @@ void jf_disk_init()
     }
 
     if (s_buffer == NULL) assert((s_buffer = jf_growing_buffer_new(0)) != NULL);
+    if (s_write_buffer == NULL) assert((s_write_buffer = jf_growing_buffer_new(0)) != NULL);
 
-    assert((s_payload.header_path = jf_concat(2, g_state.runtime_dir, "/s_payload_header")) != NULL);
     assert((s_payload.body_path = jf_concat(2, g_state.runtime_dir, "/s_payload_body")) != NULL);
-    assert((s_playlist.header_path = jf_concat(2, g_state.runtime_dir, "/s_playlist_header")) != NULL);
     assert((s_playlist.body_path = jf_concat(2, g_state.runtime_dir, "/s_playlist_body")) != NULL);
 
-    if ((access(s_payload.header_path, F_OK)
-                && access(s_payload.body_path, F_OK)
-                && access(s_playlist.header_path, F_OK)
+    if ((access(s_payload.body_path, F_OK)
                 && access(s_playlist.body_path, F_OK)) == 0) {
         fprintf(stderr, "Warning: there are files from another jftui session in %s.\n", g_state.runtime_dir);
         fprintf(stderr, "If you want to run multiple instances concurrently, make sure to specify a distinct --runtime-dir for each one after the first or they will interfere with each other.\n");
@@ -176,56 +413,160 @@ void jf_disk_init()
 
     jf_disk_open(&s_payload);
     jf_disk_open(&s_playlist);
+
+    if (s_subtitles_dir == NULL) {
+        assert((s_subtitles_dir = jf_concat(2, g_state.runtime_dir, "/subtitles")) != NULL);
+        if (access(s_subtitles_dir, F_OK) != 0) {
+            assert(mkdir(s_subtitles_dir, S_IRWXU) != -1);
+        }
+    }
+
+    if (s_staging.pending == NULL) {
+        pthread_t writer_thread;
+
+        s_staging.pending = jf_growing_buffer_new(JF_DISK_STAGING_FLUSH_SIZE);
+        s_staging.writing = jf_growing_buffer_new(JF_DISK_STAGING_FLUSH_SIZE);
+        assert(pthread_create(&writer_thread, NULL, jf_disk_payload_writer_thread, NULL) == 0);
+        assert(pthread_detach(writer_thread) == 0);
+    }
 }
 
 
 void jf_disk_refresh()
 {
-    assert(fclose(s_payload.header) == 0);
-    assert(fclose(s_payload.body) == 0);
-    jf_disk_open(&s_payload);
-    assert(fclose(s_playlist.header) == 0);
+    jf_disk_payload_refresh();
+
     assert(fclose(s_playlist.body) == 0);
     jf_disk_open(&s_playlist);
 }
 
 
+void jf_disk_payload_refresh(void)
+{
+    // whatever is still staged belongs to the old body: drop it, but let the
+    // writer finish a write in progress before pulling the file from under it
+    pthread_mutex_lock(&s_staging.mut);
+    jf_growing_buffer_empty(s_staging.pending);
+    s_staging.flush_requested = false;
+    while (s_staging.busy) {
+        pthread_cond_wait(&s_staging.cv_idle, &s_staging.mut);
+    }
+    pthread_mutex_lock(&s_payload_io_mut);
+    assert(fclose(s_payload.body) == 0);
+    jf_disk_open(&s_payload);
+    pthread_mutex_unlock(&s_payload_io_mut);
+    pthread_mutex_unlock(&s_staging.mut);
+}
+
+
 void jf_disk_clear()
 {
-    if (s_payload.header_path != NULL) unlink(s_payload.header_path);
     if (s_payload.body_path != NULL) unlink(s_payload.body_path);
-    if (s_playlist.header_path != NULL) unlink(s_playlist.header_path);
     if (s_playlist.body_path != NULL) unlink(s_playlist.body_path);
 }
 
 
+static void jf_disk_payload_staged(const size_t length)
+{
+    if (s_payload.count == s_payload.offsets_size) {
+        s_payload.offsets_size *= 2;
+        assert((s_payload.offsets = realloc(s_payload.offsets,
+                        s_payload.offsets_size * sizeof(long))) != NULL);
+        assert((s_payload.lengths = realloc(s_payload.lengths,
+                        s_payload.offsets_size * sizeof(size_t))) != NULL);
+    }
+    // the payload body is append-only, so the record will land right after
+    // all the others
+    s_payload.offsets[s_payload.count] = (long)s_payload.live_bytes;
+    s_payload.lengths[s_payload.count] = length;
+    s_payload.live_bytes += length;
+    s_payload.count++;
+    if (s_staging.pending->used >= JF_DISK_STAGING_FLUSH_SIZE) {
+        s_staging.flush_requested = true;
+        pthread_cond_signal(&s_staging.cv_work);
+    }
+}
+
+
 void jf_disk_payload_add_item(const jf_menu_item *item)
 {
     if (item == NULL) return;
-    jf_disk_add_item(&s_payload, item);
+
+    pthread_mutex_lock(&s_staging.mut);
+    jf_disk_payload_staged(jf_disk_serialize(s_staging.pending, item));
+    pthread_mutex_unlock(&s_staging.mut);
+}
+
+
+void jf_disk_payload_add_record(const jf_item_type type,
+        const char *id,
+        const char *name,
+        const size_t name_length,
+        const long long runtime_ticks,
+        const long long playback_ticks,
+        const size_t part_count)
+{
+    size_t starting_used;
+
+    pthread_mutex_lock(&s_staging.mut);
+    starting_used = s_staging.pending->used;
+    jf_disk_serialize_record(s_staging.pending,
+            type,
+            id,
+            name,
+            name_length,
+            runtime_ticks,
+            playback_ticks,
+            part_count,
+            false,
+            0);
+    jf_disk_payload_staged(s_staging.pending->used - starting_used);
+    pthread_mutex_unlock(&s_staging.mut);
+}
+
+
+void jf_disk_payload_flush()
+{
+    pthread_mutex_lock(&s_staging.mut);
+    if (s_staging.pending->used > 0) {
+        s_staging.flush_requested = true;
+        pthread_cond_signal(&s_staging.cv_work);
+    }
+    pthread_mutex_unlock(&s_staging.mut);
 }
 
 
 jf_menu_item *jf_disk_payload_get_item(const size_t n)
 {
-    return jf_disk_get_item(&s_payload, n);
+    jf_menu_item *item;
+
+    jf_disk_payload_sync();
+    pthread_mutex_lock(&s_payload_io_mut);
+    item = jf_disk_get_item(&s_payload, n);
+    pthread_mutex_unlock(&s_payload_io_mut);
+    return item;
 }
 
 
 const char *jf_disk_playlist_get_item_name(const size_t n)
 {
+    uint64_t start_us;
 
     if (n == 0 || n > s_playlist.count) {
         return "Warning: requesting item out of bounds. This is a bug.";
     }
 
-    jf_disk_align_to(&s_playlist, n);
+    start_us = jf_stats_now_us();
+
+    // jump straight past type and id to the name
     assert(fseek(s_playlist.body,
+                s_playlist.offsets[n - 1]
                 // let him who hath understanding reckon the number of the beast!
-                sizeof(jf_item_type) + sizeof(((jf_menu_item *)666)->id),
-                SEEK_CUR) == 0);
+                + (long)(sizeof(jf_item_type) + sizeof(((jf_menu_item *)666)->id)),
+                SEEK_SET) == 0);
 
     jf_disk_read_to_null_to_buffer(&s_playlist);
+    jf_stats_disk_record(JF_STATS_DISK_READ, s_buffer->used, 1, jf_stats_now_us() - start_us);
 
     return (const char *)s_buffer->buf;
 }
@@ -234,16 +575,23 @@ const char *jf_disk_playlist_get_item_name(const size_t n)
 jf_item_type jf_disk_payload_get_type(const size_t n)
 {
     jf_item_type item_type;
+    uint64_t start_us;
 
     if (n == 0 || n > s_payload.count) {
         return JF_ITEM_TYPE_NONE;
     }
 
+    jf_disk_payload_sync();
+    start_us = jf_stats_now_us();
+    pthread_mutex_lock(&s_payload_io_mut);
     jf_disk_align_to(&s_payload, n);
     if (fread(&(item_type), sizeof(jf_item_type), 1, s_payload.body) != 1) {
+        pthread_mutex_unlock(&s_payload_io_mut);
         fprintf(stderr, "Warning: jf_payload_get_type: could not read type for item %zu in s_payload.body.\n", n);
         return JF_ITEM_TYPE_NONE;
     }
+    pthread_mutex_unlock(&s_payload_io_mut);
+    jf_stats_disk_record(JF_STATS_DISK_READ, sizeof(jf_item_type), 1, jf_stats_now_us() - start_us);
     return item_type;
 }
 
@@ -270,17 +618,33 @@ jf_menu_item *jf_disk_playlist_get_item(const size_t n)
 void jf_disk_playlist_replace_item(const size_t n, const jf_menu_item *item)
 {
     long starting_body_offset;
+    uint64_t start_us;
 
     assert(item != NULL);
+    assert(n > 0 && n <= s_playlist.count);
 
-    // overwrite old offset in header
-    assert(fseek(s_playlist.header, (long)((n - 1) * sizeof(long)), SEEK_SET) == 0);
+    start_us = jf_stats_now_us();
+
+    // overwrite old offset in index
     assert(fseek(s_playlist.body, 0, SEEK_END) == 0);
     assert((starting_body_offset = ftell(s_playlist.body)) != -1);
-    assert(fwrite(&starting_body_offset, sizeof(long), 1, s_playlist.header) == 1);
-
-    // add replacement to tail
-    jf_disk_add_next(&s_playlist, item);
+    s_playlist.offsets[n - 1] = starting_body_offset;
+
+    // add replacement to tail, the old record is now garbage
+    s_playlist.dead_bytes += s_playlist.lengths[n - 1];
+    s_playlist.live_bytes -= s_playlist.lengths[n - 1];
+    s_playlist.lengths[n - 1] = jf_disk_add_next(&s_playlist, item);
+    s_playlist.live_bytes += s_playlist.lengths[n - 1];
+    jf_stats_disk_record(JF_STATS_DISK_WRITE,
+            s_playlist.lengths[n - 1],
+            1,
+            jf_stats_now_us() - start_us);
+
+    if (s_playlist.dead_bytes >= JF_DISK_COMPACT_MIN_DEAD_BYTES
+            && s_playlist.dead_bytes > s_playlist.live_bytes) {
+        jf_disk_compact(&s_playlist);
+    }
+    jf_stats_disk_playlist_usage(s_playlist.live_bytes, s_playlist.dead_bytes);
 }
 
 
@@ -288,3 +652,59 @@ size_t jf_disk_playlist_item_count()
 {
     return s_playlist.count;
 }
+
+
+////////// SUBTITLE CACHE //////////
+static char *jf_disk_subtitle_path(const char *resource)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    const char *c, *extension;
+    char name[sizeof("/") + 16];
+
+    for (c = g_options.server; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 0x100000001b3;
+    }
+    for (c = resource; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 0x100000001b3;
+    }
+    if ((extension = strrchr(resource, '.')) == NULL || strchr(extension, '/') != NULL) {
+        extension = "";
+    }
+    snprintf(name, sizeof(name), "/%016" PRIx64, hash);
+    return jf_concat(3, s_subtitles_dir, name, extension);
+}
+
+
+char *jf_disk_subtitle_missing(const char *resource)
+{
+    char *path = jf_disk_subtitle_path(resource);
+
+    if (access(path, F_OK) == 0) {
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+
+char *jf_disk_subtitle_get(const char *resource)
+{
+    char *path = jf_disk_subtitle_path(resource);
+
+    if (access(path, R_OK) != 0) {
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+
+void jf_disk_subtitle_drop(const char *resource)
+{
+    char *path = jf_disk_subtitle_path(resource);
+
+    unlink(path);
+    free(path);
+}
+////////////////////////////////////
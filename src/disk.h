@@ -9,16 +9,32 @@
 
 ////////// CONSTANTS //////////
 #define JF_DISK_BUFFER_SIZE 1024
+
+// replacing playlist items leaves the old records behind as garbage in the
+// body: once there is at least this much of it and it makes up more than
+// half of the body, the live records are copied to a fresh file
+#define JF_DISK_COMPACT_MIN_DEAD_BYTES (64 * 1024)
+
+// payload records staged in memory before the writer thread is woken up
+#define JF_DISK_STAGING_FLUSH_SIZE (64 * 1024)
 ///////////////////////////////
 
 
 ////////// FILE CACHE //////////
+// Items are serialized back to back in body. The offset of the n-th item in
+// body is kept in memory at offsets[n - 1], so that random access costs a
+// single fseek. The serialized size of that item is at lengths[n - 1].
+// body only ever grows: bytes that no item refers to anymore are counted in
+// dead_bytes until jf_disk_compact gets rid of them.
 typedef struct jf_file_cache {
-    FILE *header;
-    char *header_path;
     FILE *body;
     char *body_path;
+    long *offsets;
+    size_t *lengths;
+    size_t offsets_size;
     size_t count;
+    size_t live_bytes;
+    size_t dead_bytes;
 } jf_file_cache;
 ///////////////////////////////
 
@@ -26,11 +42,39 @@ typedef struct jf_file_cache {
 ////////// FUNCTION STUBS //////////
 char *jf_disk_get_default_runtime_dir(void);
 void jf_disk_init(void);
+// Starts over with an empty payload and an empty playlist.
 void jf_disk_refresh(void);
+// Starts over with an empty payload only, leaving the playlist alone (e.g.
+// browsing while it plays).
+// CAN FATAL.
+void jf_disk_payload_refresh(void);
 void jf_disk_clear(void);
 
 
+// Payload records are only staged in memory by jf_disk_payload_add_item and
+// written out by a background thread, so that the parser never waits on
+// stdio. Reads wait for anything still staged to be written first.
 void jf_disk_payload_add_item(const jf_menu_item *item);
+
+// Same as jf_disk_payload_add_item for a childless item with the given
+// fields, without building one.
+//
+// Parameters:
+//  - id: at least JF_ID_LENGTH long or \0-terminated, may be NULL.
+//  - name: name_length bytes, need not be \0-terminated.
+//  - part_count: see jf_menu_item, 0 if unknown.
+// CAN FATAL.
+void jf_disk_payload_add_record(const jf_item_type type,
+        const char *id,
+        const char *name,
+        const size_t name_length,
+        const long long runtime_ticks,
+        const long long playback_ticks,
+        const size_t part_count);
+
+// Wakes the writer for whatever is staged, without waiting for it.
+// CAN'T FAIL.
+void jf_disk_payload_flush(void);
 jf_menu_item *jf_disk_payload_get_item(const size_t n);
 jf_item_type jf_disk_payload_get_type(const size_t n);
 size_t jf_disk_payload_item_count(void);
@@ -41,5 +85,19 @@ void jf_disk_playlist_replace_item(const size_t n, const jf_menu_item *item);
 jf_menu_item *jf_disk_playlist_get_item(const size_t n);
 const char *jf_disk_playlist_get_item_name(const size_t n);
 size_t jf_disk_playlist_item_count(void);
+
+
+// External subtitle files are cached in the runtime directory, across
+// sessions. resource is the path of the file on the server.
+//
+// jf_disk_subtitle_missing returns the (malloc'd) path a download of it
+// should be stored at, NULL if it's cached already.
+// jf_disk_subtitle_get returns the (malloc'd) path of the cached copy, NULL
+// if there is none (yet).
+// jf_disk_subtitle_drop forgets the cached copy, e.g. one mpv choked on.
+// CAN FATAL.
+char *jf_disk_subtitle_missing(const char *resource);
+char *jf_disk_subtitle_get(const char *resource);
+void jf_disk_subtitle_drop(const char *resource);
 ////////////////////////////////////
 #endif
@@ -3,6 +3,8 @@
 #include "shared.h"
 #include "menu.h"
 #include "disk.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,6 +36,16 @@ static int jf_sax_items_end_array(void *ctx);
 static int jf_sax_items_string(void *ctx, const unsigned char *string, size_t strins_len);
 static int jf_sax_items_number(void *ctx, const char *string, size_t strins_len);
 
+static int jf_sax_parts_start_map(void *ctx);
+static int jf_sax_parts_end_map(void *ctx);
+static int jf_sax_parts_map_key(void *ctx, const unsigned char *key, size_t key_len);
+static int jf_sax_parts_start_array(void *ctx);
+static int jf_sax_parts_end_array(void *ctx);
+static int jf_sax_parts_null(void *ctx);
+static int jf_sax_parts_boolean(void *ctx, int boolean);
+static int jf_sax_parts_string(void *ctx, const unsigned char *string, size_t string_len);
+static int jf_sax_parts_number(void *ctx, const char *string, size_t string_len);
+
 // Allocates a new yajl parser instance, registering callbacks and context and
 // setting yajl_allow_multiple_values to let it digest multiple JSON messages
 // in a row.
@@ -48,6 +60,9 @@ static int jf_sax_items_number(void *ctx, const char *string, size_t strins_len)
 static inline yajl_handle jf_sax_yajl_parser_new(yajl_callbacks *callbacks, jf_sax_context *context);
 
 static inline bool jf_sax_current_item_is_valid(const jf_sax_context *context);
+
+// PartCount is not defined when it is == 1, but only videos have one.
+static inline size_t jf_sax_current_item_part_count(const jf_sax_context *context);
 static inline void jf_sax_current_item_make_and_print_name(jf_sax_context *context);
 static inline void jf_sax_context_init(jf_sax_context *context, jf_thread_buffer *tb);
 static inline void jf_sax_context_current_item_clear(jf_sax_context *context);
@@ -71,7 +86,6 @@ static int jf_sax_items_start_map(void *ctx)
         case JF_SAX_IDLE:
             context->tb->item_count = 0;
             jf_sax_context_current_item_clear(context);
-            jf_disk_refresh();
             context->parser_state = JF_SAX_IN_QUERYRESULT_MAP;
             break;
         case JF_SAX_IN_LATEST_ARRAY:
@@ -117,14 +131,15 @@ static int jf_sax_items_end_map(void *ctx)
                 context->tb->item_count++;
                 jf_sax_current_item_make_and_print_name(context);
 
-                jf_menu_item *item = jf_menu_item_new(context->current_item_type,
-                        NULL,
-                        (const char*)context->id,
+                // straight from the context to the cache record (strlen
+                // rather than used: a \u0000 in the JSON would embed a \0)
+                jf_disk_payload_add_record(context->current_item_type,
+                        (const char *)context->id,
                         context->current_item_display_name->buf,
+                        strlen(context->current_item_display_name->buf),
                         context->runtime_ticks,
-                        context->playback_ticks);
-                jf_disk_payload_add_item(item);
-                jf_menu_item_free(item);
+                        context->playback_ticks,
+                        jf_sax_current_item_part_count(context));
             }
             jf_sax_context_current_item_clear(context);
 
@@ -180,6 +195,8 @@ static int jf_sax_items_map_key(void *ctx, const unsigned char *key, size_t key_
                 context->parser_state = JF_SAX_IN_ITEM_PARENT_INDEX_VALUE;
             } else if (JF_SAX_KEY_IS("RunTimeTicks")) {
                 context->parser_state = JF_SAX_IN_ITEM_RUNTIME_TICKS_VALUE;
+            } else if (JF_SAX_KEY_IS("PartCount")) {
+                context->parser_state = JF_SAX_IN_ITEM_PART_COUNT_VALUE;
             } else if (JF_SAX_KEY_IS("UserData")) {
                 context->parser_state = JF_SAX_IN_USERDATA_VALUE;
             }
@@ -330,6 +347,10 @@ static int jf_sax_items_number(void *ctx, const char *string, size_t string_len)
             context->runtime_ticks = strtoll(string, NULL, 10);
             context->parser_state = JF_SAX_IN_ITEM_MAP;
             break;
+        case JF_SAX_IN_ITEM_PART_COUNT_VALUE:
+            context->part_count = strtoll(string, NULL, 10);
+            context->parser_state = JF_SAX_IN_ITEM_MAP;
+            break;
         case JF_SAX_IN_USERDATA_TICKS_VALUE:
             context->playback_ticks = strtoll(string, NULL, 10);
             context->parser_state = JF_SAX_IN_USERDATA_MAP;
@@ -368,6 +389,16 @@ static inline bool jf_sax_current_item_is_valid(const jf_sax_context *context)
 }
 
 
+static inline size_t jf_sax_current_item_part_count(const jf_sax_context *context)
+{
+    if (context->current_item_type != JF_ITEM_TYPE_EPISODE
+            && context->current_item_type != JF_ITEM_TYPE_MOVIE) {
+        return 0;
+    }
+    return context->part_count > 1 ? (size_t)context->part_count : 1;
+}
+
+
 static inline void jf_sax_current_item_make_and_print_name(jf_sax_context *context)
 {
     jf_growing_buffer_empty(context->current_item_display_name);
@@ -474,6 +505,7 @@ static inline void jf_sax_context_current_item_clear(jf_sax_context *context)
     context->parent_index_len = 0;
     context->runtime_ticks = 0;
     context->playback_ticks = 0;
+    context->part_count = 0;
 
     free(context->copy_buffer);
     context->copy_buffer = NULL;
@@ -520,7 +552,11 @@ void *jf_json_sax_thread(void *arg)
         .yajl_end_array = jf_sax_items_end_array
     };
     unsigned char *error_str;
+    // for the current document
+    size_t bytes = 0;
+    uint64_t parse_us = 0, start_us;
 
+    jf_trace_thread_name("sax parser");
     jf_sax_context_init(&context, (jf_thread_buffer *)arg);
 
     assert((parser = jf_sax_yajl_parser_new(&callbacks, &context)) != NULL);
@@ -530,7 +566,12 @@ void *jf_json_sax_thread(void *arg)
         while (context.tb->state != JF_THREAD_BUFFER_STATE_PENDING_DATA) {
             pthread_cond_wait(&context.tb->cv_no_data, &context.tb->mut);
         }
-        if ((status = yajl_parse(parser, (unsigned char*)context.tb->data, context.tb->used)) != yajl_status_ok) {
+        start_us = jf_stats_now_us();
+        status = yajl_parse(parser, (unsigned char*)context.tb->data, context.tb->used);
+        parse_us += jf_stats_now_us() - start_us;
+        jf_trace_end("parser", "yajl_parse", start_us, NULL);
+        bytes += context.tb->used;
+        if (status != yajl_status_ok) {
             error_str = yajl_get_error(parser, 1, (unsigned char*)context.tb->data, context.tb->used);
             strcpy(context.tb->data, "yajl_parse error: ");
             strncat(context.tb->data, (char *)error_str, JF_PARSER_ERROR_BUFFER_SIZE - strlen(context.tb->data));
@@ -540,10 +581,16 @@ void *jf_json_sax_thread(void *arg)
             // the parser never recovers after an error; we must free and reallocate it
             yajl_free(parser);
             parser = jf_sax_yajl_parser_new(&callbacks, &context);
+            bytes = 0;
+            parse_us = 0;
         } else if (context.parser_state == JF_SAX_IDLE) {
             // JSON fully parsed
             yajl_complete_parse(parser);
+            jf_disk_payload_flush();
             context.tb->state = JF_THREAD_BUFFER_STATE_CLEAR;
+            jf_stats_parser_record(context.tb->item_count, bytes, parse_us);
+            bytes = 0;
+            parse_us = 0;
         } else if (context.copy_buffer == NULL) {
             // we've still more to go, so we populate the copy buffer to not lose data
             // but if it is already filled from last time, filling it again would be unnecessary
@@ -561,6 +608,139 @@ void *jf_json_sax_thread(void *arg)
 ////////////////////////////////
 
 
+////////// PARTS USER DATA EXTRACTOR //////////
+static int jf_sax_parts_start_map(void *ctx)
+{
+    jf_sax_parts_context *context = (jf_sax_parts_context *)(ctx);
+    context->depth++;
+    if (context->in_items && context->depth == 3) {
+        // a new item
+        context->id[0] = '\0';
+        context->playback_ticks = 0;
+        context->played = false;
+    } else if (context->in_items
+            && context->depth == 4
+            && context->key == JF_SAX_PARTS_KEY_USERDATA) {
+        context->in_user_data = true;
+    }
+    context->key = JF_SAX_PARTS_KEY_NONE;
+    return 1;
+}
+
+
+static int jf_sax_parts_end_map(void *ctx)
+{
+    jf_sax_parts_context *context = (jf_sax_parts_context *)(ctx);
+    size_t i;
+
+    if (context->in_user_data && context->depth == 4) {
+        context->in_user_data = false;
+    } else if (context->in_items && context->depth == 3) {
+        for (i = 1; i < context->item->children_count; i++) {
+            if (strncmp(context->item->children[i]->id, context->id, JF_ID_LENGTH) != 0) continue;
+            context->item->children[i]->playback_ticks = context->playback_ticks;
+            if (context->played_parts != NULL) {
+                context->played_parts[i] = context->played;
+            }
+            context->parts_found++;
+            break;
+        }
+    }
+    context->depth--;
+    return 1;
+}
+
+
+static int jf_sax_parts_map_key(void *ctx, const unsigned char *key, size_t key_len)
+{
+    jf_sax_parts_context *context = (jf_sax_parts_context *)(ctx);
+    context->key = JF_SAX_PARTS_KEY_NONE;
+    if (context->depth == 1) {
+        if (JF_SAX_KEY_IS("Items")) {
+            context->key = JF_SAX_PARTS_KEY_ITEMS;
+        }
+    } else if (context->in_items && context->depth == 3) {
+        if (JF_SAX_KEY_IS("Id")) {
+            context->key = JF_SAX_PARTS_KEY_ID;
+        } else if (JF_SAX_KEY_IS("UserData")) {
+            context->key = JF_SAX_PARTS_KEY_USERDATA;
+        }
+    } else if (context->in_user_data) {
+        if (JF_SAX_KEY_IS("PlaybackPositionTicks")) {
+            context->key = JF_SAX_PARTS_KEY_TICKS;
+        } else if (JF_SAX_KEY_IS("Played")) {
+            context->key = JF_SAX_PARTS_KEY_PLAYED;
+        }
+    }
+    return 1;
+}
+
+
+static int jf_sax_parts_start_array(void *ctx)
+{
+    jf_sax_parts_context *context = (jf_sax_parts_context *)(ctx);
+    context->depth++;
+    if (context->depth == 2 && context->key == JF_SAX_PARTS_KEY_ITEMS) {
+        context->in_items = true;
+    }
+    context->key = JF_SAX_PARTS_KEY_NONE;
+    return 1;
+}
+
+
+static int jf_sax_parts_end_array(void *ctx)
+{
+    jf_sax_parts_context *context = (jf_sax_parts_context *)(ctx);
+    if (context->depth == 2) {
+        context->in_items = false;
+    }
+    context->depth--;
+    return 1;
+}
+
+
+static int jf_sax_parts_null(void *ctx)
+{
+    ((jf_sax_parts_context *)(ctx))->key = JF_SAX_PARTS_KEY_NONE;
+    return 1;
+}
+
+
+static int jf_sax_parts_boolean(void *ctx, int boolean)
+{
+    jf_sax_parts_context *context = (jf_sax_parts_context *)(ctx);
+    if (context->key == JF_SAX_PARTS_KEY_PLAYED) {
+        context->played = boolean;
+    }
+    context->key = JF_SAX_PARTS_KEY_NONE;
+    return 1;
+}
+
+
+static int jf_sax_parts_string(void *ctx, const unsigned char *string, size_t string_len)
+{
+    jf_sax_parts_context *context = (jf_sax_parts_context *)(ctx);
+    if (context->key == JF_SAX_PARTS_KEY_ID && string_len == JF_ID_LENGTH) {
+        memcpy(context->id, string, JF_ID_LENGTH);
+        context->id[JF_ID_LENGTH] = '\0';
+    }
+    context->key = JF_SAX_PARTS_KEY_NONE;
+    return 1;
+}
+
+
+static int jf_sax_parts_number(void *ctx, const char *string, __attribute__((unused)) size_t string_len)
+{
+    jf_sax_parts_context *context = (jf_sax_parts_context *)(ctx);
+    if (context->key == JF_SAX_PARTS_KEY_TICKS) {
+        context->playback_ticks = strtoll(string, NULL, 10);
+    }
+    context->key = JF_SAX_PARTS_KEY_NONE;
+    return 1;
+}
+///////////////////////////////////////////////
+
+
 ////////// VIDEO PARSING //////////
 static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item, const yajl_val media_sources)
 {
@@ -568,6 +748,7 @@ static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item, const yajl
     size_t subs_count = 0;
     size_t i, j;
     char *tmp;
+    jf_growing_buffer *url;
     yajl_val media_streams, source, stream;
 
     if (YAJL_GET_ARRAY(media_sources)->len > 1) {
@@ -616,22 +797,23 @@ static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item, const yajl
                         yajl_t_any))
                 && strcmp(codec, "sub") != 0) {
             char *id = YAJL_GET_STRING(jf_yajl_tree_get_assert(source, ((const char *[]){ "Id", NULL }), yajl_t_string));
-            tmp = jf_concat(8,
-                    "/videos/",
-                    id,
-                    "/",
-                    id,
-                    "/subtitles/",
+            url = jf_growing_buffer_scratch();
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/videos/");
+            jf_growing_buffer_append(url, id, 0);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/");
+            jf_growing_buffer_append(url, id, 0);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/subtitles/");
+            jf_growing_buffer_append(url,
                     YAJL_GET_NUMBER(jf_yajl_tree_get_assert(stream, ((const char *[]){ "Index", NULL }), yajl_t_number)),
-                    "/stream.",
-                    codec);
+                    0);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/stream.");
+            jf_growing_buffer_append(url, codec, 0);
             assert((subs = realloc(subs, ++subs_count * sizeof(jf_menu_item *))) != NULL);
             subs[subs_count - 1] = jf_menu_item_new(JF_ITEM_TYPE_VIDEO_SUB,
                     NULL, // children
                     NULL, // id
-                    tmp,
+                    jf_growing_buffer_cstr(url),
                     0, 0); // ticks
-            free(tmp);
             if ((tmp = YAJL_GET_STRING(yajl_tree_get(stream, ((const char *[]){ "Language", NULL }), yajl_t_string))) == NULL) {
                 subs[subs_count - 1]->id[0] = '\0';
             } else {
@@ -656,9 +838,9 @@ static jf_menu_item *jf_json_parse_versions(const jf_menu_item *item, const yajl
 }
 
 
-void jf_json_parse_video(jf_menu_item *item, const char *video, const char *additional_parts)
+size_t jf_json_parse_video(jf_menu_item *item, const char *video)
 {
-    yajl_val parsed, part_count, part_item;
+    yajl_val parsed, part_count;
     size_t i;
 
     JF_JSON_TREE_PARSE_ASSERT((parsed = yajl_tree_parse(video, s_error_buffer, JF_PARSER_ERROR_BUFFER_SIZE)) != NULL);
@@ -668,52 +850,89 @@ void jf_json_parse_video(jf_menu_item *item, const char *video, const char *addi
     } else {
         item->children_count = (size_t)YAJL_GET_INTEGER(part_count);
     }
+    item->part_count = item->children_count;
     assert((item->children = malloc(item->children_count * sizeof(jf_menu_item *))) != NULL);
     item->children[0] = jf_json_parse_versions(item,
             jf_yajl_tree_get_assert(parsed,
                 ((const char *[]){ "MediaSources", NULL }),
                 yajl_t_array));
     yajl_tree_free(parsed);
-
-    // check for additional parts
-    if (item->children_count > 1) {
-        s_error_buffer[0] = '\0';
-        if ((parsed = yajl_tree_parse(additional_parts,
-                        s_error_buffer,
-                        JF_PARSER_ERROR_BUFFER_SIZE)) == NULL) {
-            fprintf(stderr, "FATAL: jf_json_parse_additional_parts: %s\n",
-                    s_error_buffer[0] == '\0' ? "yajl_tree_parse unknown error" : s_error_buffer);
-            jf_exit(JF_EXIT_FAILURE);
-        }
-        for (i = 1; i < item->children_count; i++) {
-            part_item = YAJL_GET_ARRAY(jf_yajl_tree_get_assert(parsed,
-                        ((const char *[]){ "Items", NULL }),
-                        yajl_t_array))->values[i - 1];
-            item->children[i] = jf_json_parse_versions(item,
-                    jf_yajl_tree_get_assert(part_item,
-                        ((const char *[]){ "MediaSources", NULL }),
-                        yajl_t_array));
-        }
-        yajl_tree_free(parsed);
+    for (i = 1; i < item->children_count; i++) {
+        item->children[i] = NULL;
     }
 
     // the parent item refers the same part as the first child. for the sake
     // of the resume interface, copy playback_ticks from parent to firstborn
     item->children[0]->playback_ticks = item->playback_ticks;
+    return item->children_count;
 }
 
 
-void jf_json_parse_playback_ticks(jf_menu_item *item, const char *payload)
+void jf_json_parse_additional_parts(jf_menu_item *item, const char *additional_parts)
 {
-    yajl_val parsed, ticks;
+    yajl_val parsed, part_item;
+    size_t i;
 
-    JF_JSON_TREE_PARSE_ASSERT((parsed = yajl_tree_parse(payload, s_error_buffer, JF_PARSER_ERROR_BUFFER_SIZE)) != NULL);
-    ticks = yajl_tree_get(parsed, (const char *[]){ "UserData", "PlaybackPositionTicks", NULL}, yajl_t_number);
-    if (ticks != NULL) {
-        item->playback_ticks = YAJL_GET_INTEGER(ticks);
+    s_error_buffer[0] = '\0';
+    if ((parsed = yajl_tree_parse(additional_parts,
+                    s_error_buffer,
+                    JF_PARSER_ERROR_BUFFER_SIZE)) == NULL) {
+        fprintf(stderr, "FATAL: jf_json_parse_additional_parts: %s\n",
+                s_error_buffer[0] == '\0' ? "yajl_tree_parse unknown error" : s_error_buffer);
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    for (i = 1; i < item->children_count; i++) {
+        part_item = YAJL_GET_ARRAY(jf_yajl_tree_get_assert(parsed,
+                    ((const char *[]){ "Items", NULL }),
+                    yajl_t_array))->values[i - 1];
+        item->children[i] = jf_json_parse_versions(item,
+                jf_yajl_tree_get_assert(part_item,
+                    ((const char *[]){ "MediaSources", NULL }),
+                    yajl_t_array));
     }
     yajl_tree_free(parsed);
 }
+
+
+size_t jf_json_parse_parts_playback_ticks(jf_menu_item *item,
+        const char *payload,
+        bool *played_parts)
+{
+    jf_sax_parts_context context = { 0 };
+    yajl_handle parser;
+    yajl_callbacks callbacks = {
+        .yajl_null = jf_sax_parts_null,
+        .yajl_boolean = jf_sax_parts_boolean,
+        .yajl_integer = NULL,
+        .yajl_double = NULL,
+        .yajl_number = jf_sax_parts_number,
+        .yajl_string = jf_sax_parts_string,
+        .yajl_start_map = jf_sax_parts_start_map,
+        .yajl_map_key = jf_sax_parts_map_key,
+        .yajl_end_map = jf_sax_parts_end_map,
+        .yajl_start_array = jf_sax_parts_start_array,
+        .yajl_end_array = jf_sax_parts_end_array
+    };
+    unsigned char *error_str;
+    size_t payload_len = strlen(payload);
+    uint64_t start_us;
+
+    context.item = item;
+    context.played_parts = played_parts;
+    start_us = jf_stats_now_us();
+    assert((parser = yajl_alloc(&callbacks, NULL, &context)) != NULL);
+    if (yajl_parse(parser, (const unsigned char *)payload, payload_len) != yajl_status_ok
+            || yajl_complete_parse(parser) != yajl_status_ok) {
+        error_str = yajl_get_error(parser, 1, (const unsigned char *)payload, payload_len);
+        fprintf(stderr, "FATAL: jf_json_parse_parts_playback_ticks: %s\n", (char *)error_str);
+        yajl_free_error(parser, error_str);
+        yajl_free(parser);
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    yajl_free(parser);
+    jf_stats_parser_record(context.parts_found, payload_len, jf_stats_now_us() - start_us);
+    return context.parts_found;
+}
 ///////////////////////////////////
 
 
@@ -93,6 +93,7 @@ typedef enum jf_sax_parser_state {
     JF_SAX_IN_USERDATA_MAP = 19,
     JF_SAX_IN_USERDATA_VALUE = 20,
     JF_SAX_IN_USERDATA_TICKS_VALUE = 21,
+    JF_SAX_IN_ITEM_PART_COUNT_VALUE = 22,
     JF_SAX_IGNORE = 127
 } jf_sax_parser_state;
 
@@ -120,6 +121,7 @@ typedef struct jf_sax_context {
     const unsigned char *parent_index;  size_t parent_index_len;
     long long runtime_ticks;
     long long playback_ticks;
+    long long part_count;
 } jf_sax_context;
 
 
@@ -128,8 +130,63 @@ void *jf_json_sax_thread(void *arg);
 
 
 ////////// VIDEO PARSING //////////
-void jf_json_parse_video(jf_menu_item *item, const char *video, const char *additional_parts);
-void jf_json_parse_playback_ticks(jf_menu_item *item, const char *payload);
+// What the next scalar value is, for the parts user data extractor.
+typedef enum jf_sax_parts_key {
+    JF_SAX_PARTS_KEY_NONE = 0,
+    JF_SAX_PARTS_KEY_ITEMS = 1,
+    JF_SAX_PARTS_KEY_ID = 2,
+    JF_SAX_PARTS_KEY_USERDATA = 3,
+    JF_SAX_PARTS_KEY_TICKS = 4,
+    JF_SAX_PARTS_KEY_PLAYED = 5
+} jf_sax_parts_key;
+
+
+typedef struct jf_sax_parts_context {
+    // nesting of maps and arrays: 1 is the QueryResult map, 2 the Items
+    // array, 3 an item map and 4 its UserData
+    size_t depth;
+    jf_sax_parts_key key;
+    bool in_items;
+    bool in_user_data;
+    char id[JF_ID_LENGTH + 1];
+    long long playback_ticks;
+    bool played;
+    jf_menu_item *item;
+    bool *played_parts;
+    size_t parts_found;
+} jf_sax_parts_context;
+
+
+// Sets up item's children from the item JSON in video: as many as its
+// PartCount, with the first (item's own media) parsed and the others NULL.
+//
+// Returns:
+//  item->children_count, which is > 1 if additional parts need to be parsed
+//  with jf_json_parse_additional_parts.
+// CAN FATAL.
+size_t jf_json_parse_video(jf_menu_item *item, const char *video);
+
+// Parses the children of item after the first from the response to
+// /videos/{id}/additionalparts.
+// CAN FATAL.
+void jf_json_parse_additional_parts(jf_menu_item *item, const char *additional_parts);
+
+// Sets the playback_ticks of the additional parts of item (children 1 and up)
+// from the UserData of the items in payload, the QueryResult of an
+// /items?ids= request. Parts are matched by Id, in whatever order they come.
+// The payload is streamed through a SAX extractor that keeps nothing but the
+// fields it needs.
+//
+// Parameters:
+//  - played_parts: may be NULL; otherwise, for every part found,
+//      played_parts[i] gets the UserData.Played flag of child i.
+//
+// Returns:
+//  The number of parts found in payload.
+// CAN FATAL.
+size_t jf_json_parse_parts_playback_ticks(jf_menu_item *item,
+        const char *payload,
+        bool *played_parts);
 ///////////////////////////////////
 
 
@@ -123,6 +123,7 @@ static char *unsupported_term[] = {"dumb","cons25","emacs",NULL};
 static linenoiseCompletionCallback *completionCallback = NULL;
 static linenoiseHintsCallback *hintsCallback = NULL;
 static linenoiseFreeHintsCallback *freeHintsCallback = NULL;
+static linenoiseWaitCallback *waitCallback = NULL;
 
 static struct termios orig_termios; /* In order to restore at exit.*/
 static int rawmode = 0; /* For atexit() function to check if restore is needed*/
@@ -422,6 +423,12 @@ void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *fn) {
     freeHintsCallback = fn;
 }
 
+/* Register a function called before blocking on a keypress, with the input
+ * fd. It may wait for the fd to become readable while doing other work. */
+void linenoiseSetWaitCallback(linenoiseWaitCallback *fn) {
+    waitCallback = fn;
+}
+
 /* This function is used by the callback function registered by the user
  * in order to add completion options given the input string when the
  * user typed <tab>. See the example.c source code for a very easy to
@@ -799,6 +806,7 @@ static int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, size_t buflen,
         int nread;
         char seq[3];
 
+        if (waitCallback != NULL) waitCallback(l.ifd);
         nread = read(l.ifd,&c,1);
         if (nread <= 0) return l.len;
 
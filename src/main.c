@@ -5,6 +5,9 @@
 #include "disk.h"
 #include "playback.h"
 #include "menu.h"
+#include "stats.h"
+#include "trace.h"
+#include "linenoise.h"
 
 
 #include <stdio.h>
@@ -15,6 +18,9 @@
 #include <errno.h>
 #include <locale.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <mpv/client.h>
 
 
@@ -25,14 +31,78 @@ mpv_handle *g_mpv_ctx = NULL;
 //////////////////////////////////////
 
 
+////////// STATIC VARIABLES //////////
+static int s_epoll_fd = -1;
+// wakeup pipe of g_mpv_ctx as registered in s_epoll_fd (it changes with the
+// core on MPV_EVENT_SHUTDOWN)
+static int s_mpv_wakeup_fd = -1;
+// see jf_net_async_done_fd
+static int s_net_done_fd = -1;
+// fires every JF_PLAYBACK_PROGRESS_SAMPLE_SECS while a file plays
+static int s_progress_timer_fd = -1;
+// false if stdin can't be polled (e.g. a regular file)
+static bool s_stdin_watched = false;
+// stdin is only in the set while jf_event_loop_wait_input runs: otherwise the
+// terminal is mpv's, and unread input would keep epoll_wait from sleeping
+static bool s_input_waiting = false;
+// the menu loop entered on MPV_EVENT_IDLE is running (events dispatched from
+// its prompt must not enter it again)
+static bool s_menu_ui_running = false;
+//////////////////////////////////////
+
+
 ////////// STATIC FUNCTIONS //////////
 static inline void jf_mpv_version_check(void);
 static void jf_print_usage(void);
 static inline void jf_missing_arg(const char *arg);
 static inline void jf_mpv_event_dispatch(const mpv_event *event);
+
+static void jf_mpv_on_playlist_next(const mpv_event_client_message *message);
+static void jf_mpv_on_playlist_prev(const mpv_event_client_message *message);
+static void jf_mpv_on_playlist_print(const mpv_event_client_message *message);
+static void jf_mpv_on_menu(const mpv_event_client_message *message);
+
+static void jf_mpv_on_sid(const mpv_event_property *property);
+static void jf_mpv_on_loop_playlist(const mpv_event_property *property);
+static void jf_mpv_on_track_list(const mpv_event_property *property);
+
+// Reads time-pos and reports progress if it moved far enough. Stops the
+// timer when there is nothing playing anymore.
+static void jf_mpv_sample_progress(void);
+
+static void jf_event_loop_init(void);
+
+// Registers the wakeup pipe of g_mpv_ctx. To be called again whenever the
+// core is recreated.
+static void jf_event_loop_watch_mpv(void);
+
+// Dispatches every mpv event queued so far, without blocking.
+static void jf_event_loop_drain_mpv(void);
+
+// Waits on the epoll set for up to timeout_ms (-1: forever).
+// Returns true if the terminal became readable, false otherwise.
+static bool jf_event_loop_wait(const int timeout_ms);
+
+static void jf_event_loop_progress_timer(const bool armed);
 //////////////////////////////////////
 
 
+////////// DISPATCH TABLES //////////
+static const jf_mpv_client_message_handler s_client_message_handlers[] = {
+    { "jftui-playlist-next", jf_mpv_on_playlist_next },
+    { "jftui-playlist-prev", jf_mpv_on_playlist_prev },
+    { "jftui-playlist-print", jf_mpv_on_playlist_print },
+    { "jftui-menu", jf_mpv_on_menu }
+};
+
+static const jf_mpv_property_handler s_property_handlers[JF_MPV_OBSERVER_COUNT] = {
+    [JF_MPV_OBSERVER_SID] = jf_mpv_on_sid,
+    [JF_MPV_OBSERVER_LOOP_PLAYLIST] = jf_mpv_on_loop_playlist,
+    [JF_MPV_OBSERVER_TRACK_LIST] = jf_mpv_on_track_list
+};
+/////////////////////////////////////
+
+
 ////////// PROGRAM TERMINATION //////////
 // Note: the signature and description of this function are in shared.h
 void jf_exit(int sig)
@@ -43,6 +113,10 @@ void jf_exit(int sig)
     if (sig == SIGABRT) {
         perror("FATAL");
     }
+    if (g_state.stats_on_exit) {
+        jf_stats_print(stderr);
+    }
+    jf_trace_close();
     jf_disk_clear();
     jf_net_clear();
     mpv_terminate_destroy(g_mpv_ctx);
@@ -76,6 +150,8 @@ static void jf_print_usage() {
     printf("\t--runtime-dir <directory> (default: $XDG_DATA_HOME/jftui)\n");
     printf("\t--login.\n");
     printf("\t--no-check-updates\n");
+    printf("\t--stats (print network, parser, disk and mpv timings to stderr on exit)\n");
+    printf("\t--trace <file> (write a Chrome trace event timeline)\n");
 }
 
 
@@ -90,11 +166,119 @@ static inline void jf_missing_arg(const char *arg)
 ////////// MISCELLANEOUS GARBAGE //////////
 
 
+static void jf_mpv_on_playlist_next(__attribute__((unused)) const mpv_event_client_message *message)
+{
+    jf_playback_next();
+}
+
+
+static void jf_mpv_on_playlist_prev(__attribute__((unused)) const mpv_event_client_message *message)
+{
+    jf_playback_previous();
+}
+
+
+static void jf_mpv_on_playlist_print(const mpv_event_client_message *message)
+{
+    size_t slice_height;
+    int mpv_flag_yes = 1, mpv_flag_no = 0;
+
+    // optional argument: rows around current item, 0 for all
+    slice_height = JF_PLAYBACK_PLAYLIST_SLICE_DEFAULT;
+    if (message->num_args > 1
+            && sscanf(message->args[1], " %zu ", &slice_height) != 1) {
+        slice_height = JF_PLAYBACK_PLAYLIST_SLICE_DEFAULT;
+    }
+    JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_no));
+    jf_term_clear_bottom(NULL);
+    jf_playback_print_playlist(slice_height);
+    JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_yes));
+}
+
+
+static void jf_mpv_on_menu(__attribute__((unused)) const mpv_event_client_message *message)
+{
+    int mpv_flag_yes = 1, mpv_flag_no = 0;
+
+    // browse and enqueue while playback goes on
+    if (g_state.state != JF_STATE_PLAYBACK || jf_menu_is_browsing()) return;
+    JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_no));
+    jf_term_clear_bottom(NULL);
+    jf_menu_browse();
+    while (g_state.state == JF_STATE_MENU_UI) jf_menu_ui();
+    JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_yes));
+}
+
+
+static void jf_mpv_on_sid(const mpv_event_property *property)
+{
+    if (property->format == MPV_FORMAT_NONE) return;
+    if (g_state.now_playing == NULL) return;
+    // subtitle track change, go and see if we need to align for split-part
+    jf_playback_align_subtitle(*(int64_t *)property->data);
+}
+
+
+static void jf_mpv_on_loop_playlist(const mpv_event_property *property)
+{
+    if (property->format == MPV_FORMAT_NONE) return;
+    if (g_state.loop_state == JF_LOOP_STATE_RESYNCING) {
+        g_state.loop_state = JF_LOOP_STATE_IN_SYNC;
+        return;
+    }
+    if (g_state.loop_state == JF_LOOP_STATE_OUT_OF_SYNC) {
+        // we're digesting a decrement caused by an EOF
+        // mid-jftui playlist
+        JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx,
+                "options/loop-playlist",
+                MPV_FORMAT_INT64,
+                &g_state.playlist_loops));
+        g_state.loop_state = JF_LOOP_STATE_RESYNCING;
+        return;
+    }
+    // the loop counter is in sync, this means the property change
+    // is user-triggered and we should abide by it
+    g_state.playlist_loops = jf_mpv_loop_playlist_count(property->data);
+    g_state.loop_state = JF_LOOP_STATE_IN_SYNC;
+}
+
+
+static void jf_mpv_on_track_list(__attribute__((unused)) const mpv_event_property *property)
+{
+    // observed without data, only to know when it changes
+    jf_playback_tracks_invalidate();
+}
+
+
+static void jf_mpv_sample_progress(void)
+{
+    int64_t playback_ticks;
+
+    // left over from a session jf_end_playback wound down
+    if (g_state.now_playing == NULL) {
+        jf_event_loop_progress_timer(false);
+        return;
+    }
+    if (mpv_get_property(g_mpv_ctx, "time-pos", MPV_FORMAT_INT64, &playback_ticks) != 0) return;
+    // check if need to update the server
+    playback_ticks = JF_SECS_TO_TICKS(playback_ticks);
+    if (llabs(playback_ticks - g_state.now_playing->playback_ticks)
+            < JF_SECS_TO_TICKS(JF_PLAYBACK_PROGRESS_DELTA_SECS)) {
+        return;
+    }
+    // good for update; note this will also start a playback session if none are there
+    jf_playback_update_progress(playback_ticks);
+}
+
+
 static inline void jf_mpv_event_dispatch(const mpv_event *event)
 {
     int64_t playback_ticks;
-    mpv_node *node;
+    const mpv_event_client_message *message;
+    const mpv_event_property *property;
+    size_t i;
     int mpv_flag_yes = 1, mpv_flag_no = 0;
+    bool queued;
 
 #ifdef JF_DEBUG
 //     printf("DEBUG: event: %s\n", mpv_event_name(event->event_id));
@@ -102,26 +286,26 @@ static inline void jf_mpv_event_dispatch(const mpv_event *event)
     switch (event->event_id) {
         case MPV_EVENT_CLIENT_MESSAGE:
             // playlist controls
-            if (((mpv_event_client_message *)event->data)->num_args > 0) {
-                if (strcmp(((mpv_event_client_message *)event->data)->args[0],
-                            "jftui-playlist-next") == 0) {
-                    jf_playback_next();
-                } else if (strcmp(((mpv_event_client_message *)event->data)->args[0],
-                            "jftui-playlist-prev") == 0) {
-                    jf_playback_previous();
-                } else if (strcmp(((mpv_event_client_message *)event->data)->args[0],
-                            "jftui-playlist-print") == 0) {
-                    JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_no));
-                    jf_term_clear_bottom(NULL);
-                    jf_playback_print_playlist(0);
-                    JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_yes));
+            message = event->data;
+            if (message->num_args == 0) break;
+            for (i = 0; i < JF_STATIC_ARRAY_COUNT(s_client_message_handlers); i++) {
+                if (strcmp(message->args[0], s_client_message_handlers[i].name) == 0) {
+                    s_client_message_handlers[i].handler(message);
+                    break;
                 }
             }
             break;
         case MPV_EVENT_START_FILE:
+            jf_playback_sync_position();
             jf_playback_load_external_subtitles();
+            jf_event_loop_progress_timer(true);
+            break;
+        case MPV_EVENT_COMMAND_REPLY:
+            jf_playback_command_reply(event->reply_userdata, event->error);
             break;
         case MPV_EVENT_END_FILE:
+            // the stop issued by jf_end_playback
+            if (g_state.now_playing == NULL) break;
             // tell server file playback stopped so it won't keep accruing progress
             playback_ticks =
                 mpv_get_property(g_mpv_ctx, "time-pos", MPV_FORMAT_INT64, &playback_ticks) == 0 ?
@@ -129,8 +313,13 @@ static inline void jf_mpv_event_dispatch(const mpv_event *event)
             jf_playback_update_stopped(playback_ticks);
             // move to next item in playlist, if any
             if (((mpv_event_end_file *)event->data)->reason == MPV_END_FILE_REASON_EOF) {
-                if (jf_playback_next()) {
-                    g_state.state = JF_STATE_PLAYBACK_NAVIGATING;
+                queued = g_state.playlist_queued > 0;
+                if (jf_playback_next_after_eof()) {
+                    // unless the item failed to load and jf_end_playback
+                    // already set the state; no idle between gapless items
+                    if (g_state.now_playing != NULL && ! queued) {
+                        g_state.state = JF_STATE_PLAYBACK_NAVIGATING;
+                    }
                 } else {
                     jf_end_playback();
                 }
@@ -148,66 +337,37 @@ static inline void jf_mpv_event_dispatch(const mpv_event *event)
                 g_state.state = JF_STATE_PLAYBACK;
                 break;
             }
-            // no need to update progress as a time-pos event gets fired
-            // immediately after
+            // progress is sampled once playback restarts
+            break;
+        case MPV_EVENT_PLAYBACK_RESTART:
+            // a seek or the file start: don't wait for the timer to tell
+            jf_mpv_sample_progress();
             break;
         case MPV_EVENT_PROPERTY_CHANGE:
-            if (((mpv_event_property *)event->data)->format == MPV_FORMAT_NONE) break;
-            if (strcmp("time-pos", ((mpv_event_property *)event->data)->name) == 0) {
-                // event valid, check if need to update the server
-                playback_ticks = JF_SECS_TO_TICKS(*(int64_t *)((mpv_event_property *)event->data)->data);
-                if (llabs(playback_ticks - g_state.now_playing->playback_ticks) < JF_SECS_TO_TICKS(10)) break;
-                // good for update; note this will also start a playback session if none are there
-                jf_playback_update_progress(playback_ticks);
-            } else if (strcmp("sid", ((mpv_event_property *)event->data)->name) == 0) {
-                // subtitle track change, go and see if we need to align for split-part
-                jf_playback_align_subtitle(*(int64_t *)((mpv_event_property *)event->data)->data);
-            } else if (strcmp("options/loop-playlist", ((mpv_event_property *)event->data)->name) == 0) {
-                if (g_state.loop_state == JF_LOOP_STATE_RESYNCING) {
-                    g_state.loop_state = JF_LOOP_STATE_IN_SYNC;
-                    break;
-                }
-                if (g_state.loop_state == JF_LOOP_STATE_OUT_OF_SYNC) {
-                    // we're digesting a decrement caused by an EOF
-                    // mid-jftui playlist
-                    JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx,
-                            "options/loop-playlist",
-                            MPV_FORMAT_INT64,
-                            &g_state.playlist_loops));
-                    g_state.loop_state = JF_LOOP_STATE_RESYNCING;
-                    break;
-                }
-                // the loop counter is in sync, this means the property change
-                // is user-triggered and we should abide by it
-                node = (((mpv_event_property *)event->data)->data);
-                switch (node->format) {
-                    case MPV_FORMAT_FLAG:
-                        // "no"
-                        g_state.playlist_loops = 0;
-                        break;
-                    case MPV_FORMAT_INT64:
-                        // a (guaranteed positive) numeral
-                        g_state.playlist_loops = (size_t)node->u.int64;
-                        break;
-                    case MPV_FORMAT_STRING:
-                        // "yes", "inf" or "force", which we treat the same
-                        g_state.playlist_loops = (size_t)-1;
-                        break;
-                    default:
-                        ;
-                }
-                g_state.loop_state = JF_LOOP_STATE_IN_SYNC;
+            property = event->data;
+            if (event->reply_userdata < JF_MPV_OBSERVER_COUNT
+                    && s_property_handlers[event->reply_userdata] != NULL) {
+                s_property_handlers[event->reply_userdata](property);
             }
             break;
         case MPV_EVENT_IDLE:
+            // already in the menu, from whose prompt this was dispatched
+            // (NB the state alone doesn't tell: jf_end_playback sets it and
+            // counts on this very event to enter the menu)
+            if (s_menu_ui_running) break;
             if (g_state.state == JF_STATE_PLAYBACK_NAVIGATING) {
                 // digest idle event while we move to the next track
                 g_state.state = JF_STATE_PLAYBACK;
+            } else if (jf_menu_is_browsing()) {
+                // playback ran out under the browser, which is the menu now
+                g_state.state = JF_STATE_MENU_UI;
             } else {
                 // go into UI mode
                 g_state.state = JF_STATE_MENU_UI;
                 JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_no));
+                s_menu_ui_running = true;
                 while (g_state.state == JF_STATE_MENU_UI) jf_menu_ui();
+                s_menu_ui_running = false;
                 JF_MPV_ASSERT(mpv_set_property(g_mpv_ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_yes));
             }
             break;
@@ -218,7 +378,8 @@ static inline void jf_mpv_event_dispatch(const mpv_event *event)
                 jf_playback_update_stopped(g_state.now_playing->playback_ticks);
             }
             // clean core abort and init a new one
-            jf_end_playback();
+            jf_end_playback_shutdown();
+            jf_event_loop_watch_mpv();
             break;
         default:
             // no-op on everything else
@@ -228,6 +389,137 @@ static inline void jf_mpv_event_dispatch(const mpv_event *event)
 ///////////////////////////////////////////
 
 
+////////// EVENT LOOP //////////
+static void jf_event_loop_init(void)
+{
+    struct epoll_event ev = { .events = 0, .data.fd = STDIN_FILENO };
+
+    assert((s_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) != -1);
+    // epoll refuses regular files, which are always readable anyway
+    s_stdin_watched = epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+    s_net_done_fd = jf_net_async_done_fd();
+    ev = (struct epoll_event){ .events = EPOLLIN, .data.fd = s_net_done_fd };
+    assert(epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, s_net_done_fd, &ev) == 0);
+    assert((s_progress_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) != -1);
+    ev = (struct epoll_event){ .events = EPOLLIN, .data.fd = s_progress_timer_fd };
+    assert(epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, s_progress_timer_fd, &ev) == 0);
+    jf_event_loop_watch_mpv();
+    linenoiseSetWaitCallback(jf_event_loop_wait_input);
+}
+
+
+static void jf_event_loop_watch_mpv(void)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    int fd;
+
+    assert((fd = mpv_get_wakeup_pipe(g_mpv_ctx)) != -1);
+    assert(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != -1);
+    ev.data.fd = fd;
+    // the pipe of a destroyed core went away with its registration, and the
+    // new one most likely got the same number: never go by the number alone
+    if (epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        assert(errno == EEXIST);
+        assert(epoll_ctl(s_epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0);
+    }
+    s_mpv_wakeup_fd = fd;
+}
+
+
+static void jf_event_loop_drain_mpv(void)
+{
+    char discard[64];
+    mpv_event *event;
+    mpv_event_id event_id;
+    uint64_t dispatch_start_us;
+
+    // empty the pipe first: a wakeup written after this is for an event we
+    // have yet to see
+    while (read(s_mpv_wakeup_fd, discard, sizeof(discard)) > 0);
+
+    while (! JF_STATE_IS_EXITING(g_state.state)) {
+        event = mpv_wait_event(g_mpv_ctx, 0);
+        // the event dies with the core on MPV_EVENT_SHUTDOWN
+        if ((event_id = event->event_id) == MPV_EVENT_NONE) break;
+        dispatch_start_us = jf_stats_now_us();
+        jf_mpv_event_dispatch(event);
+        // idle hands control to the menu: that's user time
+        if (event_id != MPV_EVENT_IDLE) {
+            jf_stats_mpv_record(event_id, jf_stats_now_us() - dispatch_start_us);
+        }
+        jf_trace_end("mpv", mpv_event_name(event_id), dispatch_start_us, NULL);
+    }
+}
+
+
+static bool jf_event_loop_wait(const int timeout_ms)
+{
+    struct epoll_event evs[4];
+    uint64_t count;
+    int i, n;
+    bool input = false;
+
+    if ((n = epoll_wait(s_epoll_fd, evs, 4, timeout_ms)) == -1) {
+        assert(errno == EINTR);
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        if (evs[i].data.fd == s_mpv_wakeup_fd) {
+            jf_event_loop_drain_mpv();
+        } else if (evs[i].data.fd == s_net_done_fd) {
+            // rearm: whoever waits on a reply checks it on return
+            if (read(s_net_done_fd, &count, sizeof(count)) == -1) {}
+        } else if (evs[i].data.fd == s_progress_timer_fd) {
+            if (read(s_progress_timer_fd, &count, sizeof(count)) == -1) {}
+            jf_mpv_sample_progress();
+        } else if (evs[i].data.fd == STDIN_FILENO) {
+            input = true;
+        }
+    }
+    return input;
+}
+
+
+static void jf_event_loop_progress_timer(const bool armed)
+{
+    struct itimerspec spec = { 0 };
+
+    if (armed) {
+        spec.it_value.tv_sec = JF_PLAYBACK_PROGRESS_SAMPLE_SECS;
+        spec.it_interval.tv_sec = JF_PLAYBACK_PROGRESS_SAMPLE_SECS;
+    }
+    assert(timerfd_settime(s_progress_timer_fd, 0, &spec, NULL) == 0);
+}
+
+
+void jf_event_loop_wait_input(int fd)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = STDIN_FILENO };
+
+    // a prompt from an mpv event dispatched while waiting for another: keep
+    // the events that follow queued until it's answered
+    if (fd != STDIN_FILENO || ! s_stdin_watched || s_input_waiting) return;
+
+    s_input_waiting = true;
+    assert(epoll_ctl(s_epoll_fd, EPOLL_CTL_MOD, STDIN_FILENO, &ev) == 0);
+    while (g_state.state == JF_STATE_MENU_UI || jf_menu_is_browsing()) {
+        if (jf_event_loop_wait(-1)) break;
+    }
+    ev.events = 0;
+    assert(epoll_ctl(s_epoll_fd, EPOLL_CTL_MOD, STDIN_FILENO, &ev) == 0);
+    s_input_waiting = false;
+}
+
+
+void jf_event_loop_await(jf_reply *reply)
+{
+    while (! jf_net_is_done(reply)) {
+        jf_event_loop_wait(-1);
+    }
+}
+////////////////////////////////
+
+
 ////////// MAIN LOOP //////////
 int main(int argc, char *argv[])
 {
@@ -292,6 +584,15 @@ int main(int argc, char *argv[])
             g_state.state = JF_STATE_STARTING_LOGIN;
         } else if (strcmp(argv[i], "--no-check-updates") == 0) {
             g_options.check_updates = false;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            g_state.stats_on_exit = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            if (++i >= argc) {
+                jf_missing_arg("--trace");
+                jf_exit(JF_EXIT_FAILURE);
+            }
+            jf_trace_open(argv[i]);
+            jf_trace_thread_name("main");
         } else if (strcmp(argv[i], "--version") == 0) {
             printf("%s\n", g_options.version);
             jf_exit(JF_EXIT_SUCCESS);
@@ -415,6 +716,7 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Warning: could not set numeric locale to sane standard. mpv might refuse to work.\n");
     }
     g_mpv_ctx = jf_mpv_context_new();
+    jf_event_loop_init();
     ////////////
 
 
@@ -443,7 +745,7 @@ int main(int argc, char *argv[])
                 jf_exit(JF_EXIT_FAILURE);
                 break;
             default:
-                jf_mpv_event_dispatch(mpv_wait_event(g_mpv_ctx, -1));
+                jf_event_loop_wait(-1);
         }
     }
     ///////////////////////////////
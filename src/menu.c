@@ -3,6 +3,8 @@
 #include "config.h"
 #include "net.h"
 #include "disk.h"
+#include "stats.h"
+#include "trace.h"
 #include "playback.h"
 #include "linenoise.h"
 
@@ -34,7 +36,7 @@ static jf_menu_item *s_root_menu = &(jf_menu_item){
                 0,
                 "",
                 "Favorites",
-                0, 0
+                0, 0, 0, false
             },
             &(jf_menu_item){
                 JF_ITEM_TYPE_MENU_CONTINUE,
@@ -42,7 +44,7 @@ static jf_menu_item *s_root_menu = &(jf_menu_item){
                 0,
                 "",
                 "Continue Watching",
-                0, 0
+                0, 0, 0, false
             },
             &(jf_menu_item){
                 JF_ITEM_TYPE_MENU_NEXT_UP,
@@ -50,7 +52,7 @@ static jf_menu_item *s_root_menu = &(jf_menu_item){
                 0,
                 "",
                 "Next Up",
-                0, 0
+                0, 0, 0, false
             },
             &(jf_menu_item){
                 JF_ITEM_TYPE_MENU_LATEST_UNPLAYED,
@@ -58,7 +60,7 @@ static jf_menu_item *s_root_menu = &(jf_menu_item){
                 0,
                 "",
                 "Latest Unplayed",
-                0, 0
+                0, 0, 0, false
             },
             &(jf_menu_item){
                 JF_ITEM_TYPE_MENU_LIBRARIES,
@@ -66,16 +68,18 @@ static jf_menu_item *s_root_menu = &(jf_menu_item){
                 0,
                 "",
                 "User Views",
-                0, 0
+                0, 0, 0, false
             }
         },
         5,
         "",
         "",
-        0, 0
+        0, 0, 0, false
     };
 static jf_menu_stack s_menu_stack = (jf_menu_stack){ 0 };
 static jf_menu_item *s_context = NULL;
+// jf_menu_browse is running
+static bool s_browsing = false;
 //////////////////////////////////////
 
 
@@ -108,7 +112,17 @@ static inline const jf_menu_item *jf_menu_stack_peek(void);
 static jf_menu_item *jf_menu_child_get(size_t n);
 static bool jf_menu_print_context(void);
 static void jf_menu_ask_resume_yn(const jf_menu_item *item, const long long ticks);
-static void jf_menu_try_play(void);
+static void jf_menu_try_play(const size_t first);
+static void jf_menu_browse_enqueued(const size_t previous_count);
+
+static void jf_menu_mark_played_state(const jf_menu_item *item,
+        const jf_http_method method,
+        jf_net_batch *batch);
+
+
+// linenoise hints callback that never hints: it runs on every keystroke, which
+// makes it the place to get the connection back up while the user types.
+static char *jf_menu_linenoise_hints_prewarm(const char *buf, int *color, int *bold);
 //////////////////////////////////////
 
 
@@ -153,111 +167,124 @@ static inline const jf_menu_item *jf_menu_stack_peek()
 
 ////////// USER INTERFACE LOOP //////////
 
-char *jf_menu_item_get_request_url(const jf_menu_item *item)
+const char *jf_menu_item_get_request_url(const jf_menu_item *item)
 {
     const jf_menu_item *parent;
+    jf_growing_buffer *url;
 
     if (item == NULL) {
         return NULL;
     }
 
+    url = jf_growing_buffer_scratch();
     switch (item->type) {
         // Atoms
         case JF_ITEM_TYPE_AUDIO:
         case JF_ITEM_TYPE_AUDIOBOOK:
         case JF_ITEM_TYPE_VIDEO_SOURCE:
-            return jf_concat(4, g_options.server, "/items/", item->id, "/file");
+            jf_growing_buffer_append(url, g_options.server, g_options.server_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items/");
+            jf_growing_buffer_append(url, item->id, 0);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/file");
+            break;
         case JF_ITEM_TYPE_EPISODE:
         case JF_ITEM_TYPE_MOVIE:
-            return jf_concat(4, "/users/", g_options.userid, "/items/", item->id);
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items/");
+            jf_growing_buffer_append(url, item->id, 0);
+            break;
         case JF_ITEM_TYPE_VIDEO_SUB:
-            return strdup(item->name);
+            jf_growing_buffer_append(url, item->name, 0);
+            break;
         // Folders
         case JF_ITEM_TYPE_COLLECTION:
         case JF_ITEM_TYPE_FOLDER:
         case JF_ITEM_TYPE_ALBUM:
         case JF_ITEM_TYPE_SEASON:
         case JF_ITEM_TYPE_SERIES:
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
             if ((parent = jf_menu_stack_peek()) != NULL && parent->type == JF_ITEM_TYPE_MENU_LATEST_UNPLAYED) {
-                return jf_concat(5,
-                        "/users/",
-                        g_options.userid,
-                        "/items/latest?groupitems=false&parentid=",
-                        item->id,
-                        "&sortby=sortname");
+                JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items/latest?groupitems=false&parentid=");
+                jf_growing_buffer_append(url, item->id, 0);
+                JF_GROWING_BUFFER_APPEND_LITERAL(url, "&sortby=sortname");
             } else {
-                return jf_concat(4,
-                        "/users/",
-                        g_options.userid,
-                        "/items?sortby=isfolder,parentindexnumber,indexnumber,productionyear,sortname&parentid=",
-                        item->id);
+                JF_GROWING_BUFFER_APPEND_LITERAL(url,
+                        "/items?sortby=isfolder,parentindexnumber,indexnumber,productionyear,sortname&parentid=");
+                jf_growing_buffer_append(url, item->id, 0);
             }
+            break;
         case JF_ITEM_TYPE_COLLECTION_MUSIC:
             if ((parent = jf_menu_stack_peek()) != NULL && parent->type == JF_ITEM_TYPE_FOLDER) {
                 // we are inside a "by folders" view
-                return jf_concat(4,
-                        "/users/",
-                        g_options.userid,
-                        "/items?sortby=isfolder,sortname&parentid=",
-                        item->id);
+                jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+                JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items?sortby=isfolder,sortname&parentid=");
+                jf_growing_buffer_append(url, item->id, 0);
             } else {
-                return jf_concat(4,
-                        "/artists?parentid=",
-                        item->id,
-                        "&userid=",
-                        g_options.userid);
+                JF_GROWING_BUFFER_APPEND_LITERAL(url, "/artists?parentid=");
+                jf_growing_buffer_append(url, item->id, 0);
+                JF_GROWING_BUFFER_APPEND_LITERAL(url, "&userid=");
+                jf_growing_buffer_append(url, g_options.userid, 0);
             }
+            break;
         case JF_ITEM_TYPE_COLLECTION_SERIES:
-            return jf_concat(4,
-                    "/users/",
-                    g_options.userid,
-                    "/items?includeitemtypes=series&recursive=true&sortby=isfolder,sortname&parentid=",
-                    item->id);
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url,
+                    "/items?includeitemtypes=series&recursive=true&sortby=isfolder,sortname&parentid=");
+            jf_growing_buffer_append(url, item->id, 0);
+            break;
         case JF_ITEM_TYPE_COLLECTION_MOVIES:
-            return jf_concat(4,
-                    "/users/",
-                    g_options.userid,
-                    "/items?includeitemtypes=Movie&recursive=true&sortby=isfolder,sortname&parentid=",
-                    item->id);
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url,
+                    "/items?includeitemtypes=Movie&recursive=true&sortby=isfolder,sortname&parentid=");
+            jf_growing_buffer_append(url, item->id, 0);
+            break;
         case JF_ITEM_TYPE_ARTIST:
-            return jf_concat(4,
-                    "/users/",
-                    g_options.userid,
-                    "/items?recursive=true&includeitemtypes=musicalbum&sortby=isfolder,productionyear,sortname&sortorder=ascending&albumartistids=",
-                    item->id);
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url,
+                    "/items?recursive=true&includeitemtypes=musicalbum&sortby=isfolder,productionyear,sortname&sortorder=ascending&albumartistids=");
+            jf_growing_buffer_append(url, item->id, 0);
+            break;
         case JF_ITEM_TYPE_SEARCH_RESULT:
-            return jf_concat(4,
-                    "/users/",
-                    g_options.userid,
-                    "/items?recursive=true&searchterm=",
-                    item->name);
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items?recursive=true&searchterm=");
+            jf_growing_buffer_append(url, item->name, 0);
+            break;
         // Persistent folders
         case JF_ITEM_TYPE_MENU_FAVORITES:
-            return jf_concat(3,
-                    "/users/",
-                    g_options.userid,
-                    "/items?filters=isfavorite&recursive=true&sortby=sortname");
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items?filters=isfavorite&recursive=true&sortby=sortname");
+            break;
         case JF_ITEM_TYPE_MENU_CONTINUE:
-            return jf_concat(3,
-                    "/users/",
-                    g_options.userid,
-                    "/items/resume?recursive=true");
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items/resume?recursive=true");
+            break;
         case JF_ITEM_TYPE_MENU_NEXT_UP:
-            return jf_concat(3, "/shows/nextup?userid=", g_options.userid, "&limit=15");
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/shows/nextup?userid=");
+            jf_growing_buffer_append(url, g_options.userid, 0);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "&limit=15");
+            break;
         case JF_ITEM_TYPE_MENU_LATEST_UNPLAYED:
             // TODO figure out what fresh insanity drives the limit amount in this case
-            return jf_concat(3, "/users/", g_options.userid, "/items/latest?limit=32");
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items/latest?limit=32");
+            break;
         case JF_ITEM_TYPE_MENU_LIBRARIES:
-            return jf_concat(3, "/users/", g_options.userid, "/views");
+            jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+            JF_GROWING_BUFFER_APPEND_LITERAL(url, "/views");
+            break;
         default:
             fprintf(stderr,
                     "Error: get_request_url was called on an unsupported item_type (%d). This is a bug.\n",
                     item->type);
             return NULL;
     }
+
+    return jf_growing_buffer_cstr(url);
 }
 
 
+
+
 static jf_menu_item *jf_menu_child_get(size_t n)
 {
     if (s_context == NULL) return NULL;
@@ -276,7 +303,7 @@ static bool jf_menu_print_context()
     size_t i;
     jf_request_type request_type = JF_REQUEST_SAX;
     jf_reply *reply;
-    char *request_url;
+    const char *request_url;
 
     if (s_context == NULL) {
         fprintf(stderr, "Error: jf_menu_print_context: s_context == NULL. This is a bug.\n");
@@ -314,8 +341,17 @@ static bool jf_menu_print_context()
                     jf_item_type_get_name(s_context->type),
                     request_url);
 #endif
-            reply = jf_net_request(request_url, request_type, JF_HTTP_GET, NULL);
-            free(request_url);
+            if (s_browsing) {
+                // the parser prints while mpv events keep being handled
+                reply = jf_net_request(request_url,
+                        request_type == JF_REQUEST_SAX ?
+                            JF_REQUEST_ASYNC_SAX : JF_REQUEST_ASYNC_SAX_PROMISCUOUS,
+                        JF_HTTP_GET,
+                        NULL);
+                jf_event_loop_await(reply);
+            } else {
+                reply = jf_net_request(request_url, request_type, JF_HTTP_GET, NULL);
+            }
             if (JF_REPLY_PTR_HAS_ERROR(reply)) {
                 jf_menu_item_free(s_context);
                 fprintf(stderr, "Error: %s.\n", jf_reply_error_string(reply));
@@ -349,10 +385,11 @@ static bool jf_menu_print_context()
 
 static void jf_menu_ask_resume_yn(const jf_menu_item *item, const long long ticks)
 {
-    char *timestamp, *question;
+    char timestamp[JF_TIMESTAMP_SIZE];
+    char *question;
 
     if (ticks == 0) return;
-    timestamp = jf_make_timestamp(ticks);
+    jf_make_timestamp(ticks, timestamp);
     question = jf_concat(5,
                     "\nWould you like to resume ",
                     item->name,
@@ -363,14 +400,13 @@ static void jf_menu_ask_resume_yn(const jf_menu_item *item, const long long tick
         JF_MPV_ASSERT(mpv_set_property_string(g_mpv_ctx, "start", timestamp));
         g_state.state = JF_STATE_PLAYBACK_START_MARK;
     }
-    free(timestamp);
     free(question);
 }
 
 
 void jf_menu_ask_resume(jf_menu_item *item)
 {
-    char **timestamps;
+    char (*timestamps)[JF_TIMESTAMP_SIZE];
     long long ticks;
     size_t i, j, markers_count;
 
@@ -402,7 +438,7 @@ void jf_menu_ask_resume(jf_menu_item *item)
         jf_menu_ask_resume_yn(item, ticks);
         return;
     }
-    assert((timestamps = malloc(markers_count * sizeof(char *))) != NULL);
+    assert((timestamps = malloc(markers_count * sizeof(*timestamps))) != NULL);
     ticks = 0;
     j = 2;
     printf("\n%s is a split-file on the server and there is progress marked on more than one part.\n",
@@ -412,7 +448,7 @@ void jf_menu_ask_resume(jf_menu_item *item)
     for (i = 0; i < item->children_count; i++) {
         if (item->children[i]->playback_ticks != 0) {
             ticks += item->children[i]->playback_ticks;
-            timestamps[j - 2] = jf_make_timestamp(ticks);
+            jf_make_timestamp(ticks, timestamps[j - 2]);
             printf("%zu. %s\n", j, timestamps[j - 2]);
             ticks += item->children[i]->runtime_ticks - item->children[i]->playback_ticks;
             j++;
@@ -425,21 +461,19 @@ void jf_menu_ask_resume(jf_menu_item *item)
         JF_MPV_ASSERT(mpv_set_property_string(g_mpv_ctx, "start", timestamps[j - 2]));
     }
     g_state.state = JF_STATE_PLAYBACK_START_MARK;
-    for (i = 0; i < markers_count; i++) {
-        free(timestamps[i]);
-    }
     free(timestamps);
 }
 
 
-static void jf_menu_try_play()
+static void jf_menu_try_play(const size_t first)
 {
     jf_menu_item *item;
 
-    if (jf_disk_playlist_item_count() > 0) {
+    if (jf_disk_playlist_item_count() >= first) {
         g_state.state = JF_STATE_PLAYBACK;
-        g_state.playlist_position = 1;
-        item = jf_disk_playlist_get_item(1);
+        g_state.playlist_position = first;
+        jf_playback_resolve_playlist(first, JF_PLAYBACK_RESOLVE_AHEAD);
+        item = jf_disk_playlist_get_item(first);
         jf_playback_play_item(item);
 #ifdef JF_DEBUG
         jf_menu_item_print(item);
@@ -537,6 +571,11 @@ void jf_menu_dotdot()
 
 void jf_menu_quit()
 {
+    if (s_browsing) {
+        // back to playback
+        s_browsing = false;
+        return;
+    }
     g_state.state = JF_STATE_USER_QUIT;
 }
 
@@ -553,21 +592,78 @@ void jf_menu_search(const char *s)
 }
 
 
-void jf_menu_mark_played(const jf_menu_item *item)
+void jf_menu_stats(void)
 {
-    char *url;
-    url = jf_concat(4, "/users/", g_options.userid, "/playeditems/", item->id);
-    jf_net_request(url, JF_REQUEST_ASYNC_DETACH, JF_HTTP_POST, NULL);
-    free(url);
+    jf_stats_print(stdout);
+}
+
+
+static void jf_menu_mark_played_state(const jf_menu_item *item,
+        const jf_http_method method,
+        jf_net_batch *batch)
+{
+    jf_growing_buffer *url = jf_growing_buffer_scratch();
+    jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+    JF_GROWING_BUFFER_APPEND_LITERAL(url, "/playeditems/");
+    jf_growing_buffer_append(url, item->id, 0);
+    if (batch == NULL) {
+        jf_net_request(jf_growing_buffer_cstr(url), JF_REQUEST_ASYNC_DETACH, method, NULL);
+    } else {
+        jf_net_batch_add(batch, jf_growing_buffer_cstr(url), method, NULL);
+    }
 }
 
 
-void jf_menu_mark_unplayed(const jf_menu_item *item)
+void jf_menu_mark_played(const jf_menu_item *item, jf_net_batch *batch)
 {
-    char *url;
-    url = jf_concat(4, "/users/", g_options.userid, "/playeditems/", item->id);
-    jf_net_request(url, JF_REQUEST_ASYNC_DETACH, JF_HTTP_DELETE, NULL);
-    free(url);
+    jf_menu_mark_played_state(item, JF_HTTP_POST, batch);
+}
+
+
+void jf_menu_mark_unplayed(const jf_menu_item *item, jf_net_batch *batch)
+{
+    jf_menu_mark_played_state(item, JF_HTTP_DELETE, batch);
+}
+
+
+static void jf_menu_browse_enqueued(const size_t previous_count)
+{
+    const size_t count = jf_disk_playlist_item_count();
+
+    // only dispatching a selection touches the playlist while browsing
+    assert(count >= previous_count);
+
+    // navigation: keep browsing
+    if (count == previous_count) return;
+
+    printf("Enqueued %zu item%s.\n", count - previous_count,
+            count - previous_count == 1 ? "" : "s");
+    s_browsing = false;
+    if (g_state.state == JF_STATE_MENU_UI) {
+        // playback ran out while browsing: start over from the new items
+        jf_menu_try_play(previous_count + 1);
+    } else {
+        jf_playback_playlist_extended();
+    }
+}
+
+
+void jf_menu_browse(void)
+{
+    if (s_browsing) return;
+
+    s_browsing = true;
+    printf("\nPlayback goes on: selected items are enqueued, q to go back.\n");
+    while (s_browsing && ! JF_STATE_IS_EXITING(g_state.state)) {
+        jf_menu_ui();
+    }
+    s_browsing = false;
+}
+
+
+bool jf_menu_is_browsing(void)
+{
+    return s_browsing;
 }
 
 
@@ -575,6 +671,8 @@ void jf_menu_ui()
 {
     yycontext yy;
     char *line = NULL;
+    uint64_t trace_start;
+    size_t playlist_count;
 
     // ACQUIRE ITEM CONTEXT
     if ((s_context = jf_menu_stack_pop()) == NULL) {
@@ -584,14 +682,27 @@ void jf_menu_ui()
     }
 
     while (true) {
+        // whatever was being prefetched belonged to the view we are leaving
+        jf_net_cancel_prefetches();
+
         // CLEAR DISK CACHE
-        jf_disk_refresh();
+        if (s_browsing) {
+            // the playlist is in use
+            jf_disk_payload_refresh();
+        } else {
+            jf_disk_refresh();
+        }
+        playlist_count = jf_disk_playlist_item_count();
 
         // PRINT MENU
+        trace_start = jf_trace_begin();
         if (! jf_menu_print_context()) {
+            jf_trace_end("menu", "jf_menu_print_context", trace_start, NULL);
             return;
         }
+        jf_trace_end("menu", "jf_menu_print_context", trace_start, s_context->name);
         // READ AND PROCESS USER COMMAND
+        jf_net_prewarm();
         memset(&yy, 0, sizeof(yycontext));
         while (true) {
             switch (yy_cmd_get_parser_state(&yy)) {
@@ -613,7 +724,11 @@ void jf_menu_ui()
                 case JF_CMD_SUCCESS:
                     free(line);
                     yyrelease(&yy);
-                    jf_menu_try_play();
+                    if (s_browsing) {
+                        jf_menu_browse_enqueued(playlist_count);
+                    } else {
+                        jf_menu_try_play(1);
+                    }
                     return;
                 case JF_CMD_FAIL_FOLDER:
                     fprintf(stderr, "Error: cannot open many folders or both folders and items with non-recursive command.\n");
@@ -650,6 +765,7 @@ void jf_menu_init()
 {
     // all linenoise setup
     linenoiseHistorySetMaxLen(16);
+    linenoiseSetHintsCallback(jf_menu_linenoise_hints_prewarm);
     
     // update server name
     s_root_menu->name = g_state.server_name;
@@ -670,6 +786,15 @@ void jf_menu_clear()
 }
 
 
+static char *jf_menu_linenoise_hints_prewarm(__attribute__((unused)) const char *buf,
+        __attribute__((unused)) int *color,
+        __attribute__((unused)) int *bold)
+{
+    jf_net_prewarm();
+    return NULL;
+}
+
+
 char *jf_menu_linenoise(const char *prompt)
 {
     char *str;
@@ -3,6 +3,7 @@
 
 
 #include "shared.h"
+#include "net.h"
 
 #include <stddef.h>
 
@@ -24,15 +25,39 @@ bool jf_menu_child_dispatch(const size_t n);
 void jf_menu_dotdot(void);
 void jf_menu_quit(void);
 void jf_menu_search(const char *s);
-void jf_menu_mark_played(const jf_menu_item *item);
-void jf_menu_mark_unplayed(const jf_menu_item *item);
+// Prints the jf_stats report to stdout.
+void jf_menu_stats(void);
+// Marks item as played (POST) or unplayed (DELETE) on the server.
+// The request goes into batch if not NULL (see jf_net_batch), is sent right
+// away otherwise.
+// CAN FATAL.
+void jf_menu_mark_played(const jf_menu_item *item, jf_net_batch *batch);
+void jf_menu_mark_unplayed(const jf_menu_item *item, jf_net_batch *batch);
 
 void jf_menu_ui(void);
+
+
+// Runs the menu during playback, until items are enqueued or the user goes
+// back with q. Listings are fetched and parsed in the background while mpv
+// events keep being dispatched, selections are appended to the playlist
+// being played. If playback runs out meanwhile, the state becomes
+// JF_STATE_MENU_UI and the first selection starts it anew.
+// CAN FATAL.
+void jf_menu_browse(void);
+bool jf_menu_is_browsing(void);
 /////////////////////////////////////////
 
 
 ////////// MISCELLANEOUS //////////
-char *jf_menu_item_get_request_url(const jf_menu_item *item);
+// Computes the URL to request for an item: the full URL for streams (atoms),
+// the suffix to append to the server address for everything else.
+//
+// Returns:
+//  A pointer to the URL, which lives in the scratch buffer of the calling
+//  thread (see jf_growing_buffer_scratch): it must not be free'd and is only
+//  valid until the scratch buffer is next used. NULL on unsupported types.
+// CAN FATAL.
+const char *jf_menu_item_get_request_url(const jf_menu_item *item);
 void jf_menu_ask_resume(jf_menu_item *item);
 
 
@@ -2,13 +2,19 @@
 #include "config.h"
 #include "shared.h"
 #include "json.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include <curl/curl.h>
 
@@ -20,7 +26,12 @@ extern jf_global_state g_state;
 
 
 ////////// STATIC VARIABLES //////////
-static CURL *s_handle = NULL;
+static jf_net_handle *s_handle = NULL;
+#if JF_NET_HAS_CURLU
+static CURLU *s_server_url = NULL;
+static char *s_server_path = NULL;
+static size_t s_server_path_len = 0;
+#endif
 static struct curl_slist *s_headers = NULL;
 static struct curl_slist *s_headers_POST = NULL;
 static char s_curl_errorbuffer[CURL_ERROR_SIZE + 1];
@@ -35,9 +46,20 @@ static pthread_rwlock_t s_share_ssl_rw;
 static pthread_rwlock_t s_share_psl_rw;
 #endif
 pthread_t s_async_threads[JF_NET_ASYNC_THREADS];
-static jf_synced_queue *s_async_queue = NULL;
+// one queue per jf_request_priority; s_async_sem counts requests across all
+static jf_synced_queue *s_async_queues[JF_REQUEST_PRIORITY_COUNT];
+static sem_t s_async_sem;
+static atomic_size_t s_prefetch_generation = 0;
+// jf_stats_now_us() of the last finished transfer or prewarm, 0 for never
+static atomic_uint_fast64_t s_last_transfer_us = 0;
+// the last jf_net_prewarm request, freed by the next one or jf_net_clear
+static jf_reply *s_prewarm_reply = NULL;
+// see jf_net_set_cainfo
+static const char *s_cainfo = NULL;
 static pthread_mutex_t s_async_mut;
 static pthread_cond_t s_async_cv;
+// see jf_net_async_done_fd
+static int s_async_done_fd = -1;
 //////////////////////////////////////
 
 
@@ -66,28 +88,68 @@ static size_t jf_check_update_header_callback(char *payload,
         size_t nmemb,
         void *userdata);
 
-static CURL *jf_net_handle_init(void);
+static jf_net_handle *jf_net_handle_init(void);
+static void jf_net_handle_free(jf_net_handle *handle);
+
+#if JF_NET_HAS_CURLU
+// Parses g_options.server into s_server_url and s_server_path the first time
+// it is called. Must wait for the server address to be known, which may come
+// after jf_net_init (e.g. interactive config running beside the update check).
+// CAN FATAL.
+static CURLU *jf_net_server_url(void);
+#endif
+
+static void jf_net_handle_set_url(jf_net_handle *handle, const char *resource);
 
-static void jf_net_handle_before_perform(CURL *handle,
+static void jf_net_handle_before_perform(jf_net_handle *handle,
         const char *resource,
         const jf_request_type request_type,
         const jf_http_method method,
         const char *payload,
         const jf_reply *reply);
 
-static void jf_net_handle_after_perform(CURL *handle,
+static void jf_net_handle_after_perform(jf_net_handle *handle,
         const CURLcode result,
         const jf_request_type request_type,
         jf_reply *reply);
 
+static void jf_net_handle_record_stats(jf_net_handle *handle,
+        const CURLcode result,
+        const jf_request_type request_type);
+
 static jf_async_request *jf_async_request_new(const char *resource,
         const jf_request_type request_type,
         const jf_http_method method,
         const char *payload);
 
-// NB DOES NOT FREE a_r->reply!!!
+// NB DOES NOT FREE a_r->reply NOR a_r->next!!!
 static void jf_async_request_free(jf_async_request *a_r);
 
+static inline jf_request_priority jf_request_type_get_priority(const jf_request_type type);
+
+static void jf_async_request_enqueue(jf_async_request *a_r);
+
+static jf_async_request *jf_async_request_dequeue(void);
+
+// Moves the body of a finished JF_REQUEST_ASYNC_DOWNLOAD to its destination
+// and frees the reply.
+static void jf_async_request_store_download(jf_async_request *a_r);
+
+// Wakes up whoever waits on async replies, with jf_net_await or on
+// s_async_done_fd.
+static void jf_async_request_notify_done(void);
+
+// Returns true if the request was cancelled, either directly or by being a
+// stale prefetch or download. In the latter case, the reply is flagged as
+// well.
+static bool jf_async_request_is_cancelled(jf_async_request *a_r);
+
+static int jf_net_xferinfo_callback(void *clientp,
+        curl_off_t dltotal,
+        curl_off_t dlnow,
+        curl_off_t ultotal,
+        curl_off_t ulnow);
+
 static void *jf_net_async_worker_thread(void *arg);
 
 static inline pthread_rwlock_t *
@@ -112,6 +174,7 @@ jf_reply *jf_reply_new()
     r->payload = NULL;
     r->size = 0;
     r->state = JF_REPLY_PENDING;
+    atomic_init(&r->cancelled, false);
     return r;
 }
 
@@ -153,6 +216,8 @@ char *jf_reply_error_string(const jf_reply *r)
             return "Locate header from redirect was missing or not formatted as expected";
         case JF_REPLY_ERROR_EXIT_REQUEST:
             return "exit request";
+        case JF_REPLY_ERROR_CANCELLED:
+            return "request cancelled";
         case JF_REPLY_ERROR_HTTP_400:
         case JF_REPLY_ERROR_NETWORK:
         case JF_REPLY_ERROR_HTTP_NOT_OK:
@@ -207,9 +272,11 @@ size_t jf_thread_buffer_callback(char *payload, size_t size, size_t nmemb, void
     size_t written_data = 0;
     size_t chunk_size;
     jf_reply *r = (jf_reply *)userdata;
+    uint64_t trace_start;
 
     pthread_mutex_lock(&s_tb.mut);
     while (written_data < real_size) {
+        trace_start = jf_trace_begin();
         // wait for parser
         while (s_tb.state == JF_THREAD_BUFFER_STATE_PENDING_DATA
                 && ! JF_STATE_IS_EXITING(g_state.state)) {
@@ -231,6 +298,7 @@ size_t jf_thread_buffer_callback(char *payload, size_t size, size_t nmemb, void
         s_tb.used = chunk_size;
         s_tb.state = JF_THREAD_BUFFER_STATE_PENDING_DATA;
         pthread_cond_signal(&s_tb.cv_no_data);
+        jf_trace_end("parser", "handoff", trace_start, NULL);
     }
     pthread_mutex_unlock(&s_tb.mut);
 
@@ -272,10 +340,6 @@ static void jf_net_init()
     
     // global config stuff
     assert(curl_global_init(CURL_GLOBAL_ALL | CURL_GLOBAL_SSL) == 0);
-    // security bypass
-    if (! g_options.ssl_verifyhost) {
-        curl_easy_setopt(s_handle, CURLOPT_SSL_VERIFYHOST, 0);
-    }
     // headers
     assert((s_headers = curl_slist_append(s_headers,
                     "accept: application/json; charset=utf-8")) != NULL);
@@ -324,9 +388,15 @@ static void jf_net_init()
     assert(pthread_detach(sax_parser_thread) == 0);
 
     // async networking
-    s_async_queue = jf_synced_queue_new(16);
+    // overflow mode: never stall the caller (e.g. the mpv event loop firing
+    // detached progress POSTs) behind a full queue
+    for (i = 0; i < JF_REQUEST_PRIORITY_COUNT; i++) {
+        s_async_queues[i] = jf_synced_queue_new(16, true);
+    }
+    assert(sem_init(&s_async_sem, 0, 0) == 0);
     assert(pthread_mutex_init(&s_async_mut, NULL) == 0);
     assert(pthread_cond_init(&s_async_cv, NULL) == 0);
+    assert((s_async_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) != -1);
 
     for (i = 0; i < JF_NET_ASYNC_THREADS; i++) {
         assert(pthread_create(s_async_threads + i, NULL, jf_net_async_worker_thread, NULL) != -1);
@@ -346,16 +416,22 @@ void jf_net_clear()
         return;
     }
 
+    // exit requests go last in line so pending progress reports still make it
     for (i = 0; i < JF_NET_ASYNC_THREADS; i++) {
-        jf_synced_queue_enqueue(s_async_queue,
-                jf_async_request_new(NULL, JF_REQUEST_EXIT, JF_HTTP_GET, NULL));
+        jf_async_request_enqueue(jf_async_request_new(NULL, JF_REQUEST_EXIT, JF_HTTP_GET, NULL));
     }
-    curl_easy_cleanup(s_handle);
+    jf_net_handle_free(s_handle);
     for (i = 0; i < JF_NET_ASYNC_THREADS; i++) {
         assert(pthread_join(s_async_threads[i], NULL) == 0);
     }
+    jf_reply_free(s_prewarm_reply);
+    s_prewarm_reply = NULL;
     curl_share_cleanup(s_curl_sh);
     curl_slist_free_all(s_headers_POST);
+#if JF_NET_HAS_CURLU
+    curl_url_cleanup(s_server_url);
+    free(s_server_path);
+#endif
     curl_global_cleanup();
 
     assert(pthread_mutex_unlock(&s_mut) == 0);
@@ -364,50 +440,164 @@ void jf_net_clear()
 
 
 ////////// NETWORKING //////////
-static CURL *jf_net_handle_init(void)
+static jf_net_handle *jf_net_handle_init(void)
 {
-    CURL *handle;
+    jf_net_handle *handle;
+    CURL *curl;
 
-    assert((handle = curl_easy_init()) != NULL);
+    assert((handle = malloc(sizeof(jf_net_handle))) != NULL);
+    assert((handle->curl = curl = curl_easy_init()) != NULL);
+#if JF_NET_HAS_CURLU
+    handle->url = NULL;
+#endif
+    handle->url_buffer = jf_growing_buffer_new(0);
 
     // report errors
     s_curl_errorbuffer[0] = '\0';
     s_curl_errorbuffer[sizeof(s_curl_errorbuffer) - 1] = '\0';
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, s_curl_errorbuffer));
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, s_curl_errorbuffer));
 
     // be a good neighbour
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_SHARE, s_curl_sh));
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L));
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_SHARE, s_curl_sh));
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L));
 
     // ask for all supported kinds of compression
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, ""));
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ""));
 
     // follow redirects and keep POST method if using it
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1));
-    JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL));
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1));
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL));
+
+    // security bypass
+    if (! g_options.ssl_verifyhost) {
+        JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L));
+    }
+    if (s_cainfo != NULL) {
+        JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_CAINFO, s_cainfo));
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    // HTTP/2 over TLS if ALPN agrees, HTTP/1.1 otherwise. This fails on
+    // libcurl builds without HTTP/2 support, which is fine: they stay on 1.1
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+
+    // small requests and replies: don't let Nagle hold them back
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L));
+    // notice dead connections in the shared cache instead of stalling on them
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L));
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 30L));
+    JF_CURL_ASSERT(curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 15L));
 
     return handle;
 }
 
 
-static void jf_net_handle_before_perform(CURL *handle,
+static void jf_net_handle_free(jf_net_handle *handle)
+{
+    if (handle == NULL) return;
+    curl_easy_cleanup(handle->curl);
+#if JF_NET_HAS_CURLU
+    curl_url_cleanup(handle->url);
+#endif
+    jf_growing_buffer_free(handle->url_buffer);
+    free(handle);
+}
+
+
+#if JF_NET_HAS_CURLU
+static CURLU *jf_net_server_url()
+{
+    char *path;
+    size_t path_len;
+
+    assert(pthread_mutex_lock(&s_mut) == 0);
+    if (s_server_url != NULL) {
+        assert(pthread_mutex_unlock(&s_mut) == 0);
+        return s_server_url;
+    }
+
+    assert((s_server_url = curl_url()) != NULL);
+    if (g_options.server == NULL
+            || curl_url_set(s_server_url, CURLUPART_URL, g_options.server, 0) != CURLUE_OK
+            || curl_url_get(s_server_url, CURLUPART_PATH, &path, 0) != CURLUE_OK) {
+        fprintf(stderr, "FATAL: could not parse server address %s.\n",
+                g_options.server == NULL ? "(null)" : g_options.server);
+        // jf_exit will go through jf_net_clear
+        pthread_mutex_unlock(&s_mut);
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    // resources carry their own leading slash
+    path_len = strlen(path);
+    while (path_len > 0 && path[path_len - 1] == '/') {
+        path_len--;
+    }
+    assert((s_server_path = strndup(path, path_len)) != NULL);
+    s_server_path_len = path_len;
+    curl_free(path);
+    curl_url_set(s_server_url, CURLUPART_QUERY, NULL, 0);
+    curl_url_set(s_server_url, CURLUPART_FRAGMENT, NULL, 0);
+
+    assert(pthread_mutex_unlock(&s_mut) == 0);
+    return s_server_url;
+}
+#endif
+
+
+static void jf_net_handle_set_url(jf_net_handle *handle, const char *resource)
+{
+    jf_growing_buffer *buffer = handle->url_buffer;
+
+    jf_growing_buffer_empty(buffer);
+#if JF_NET_HAS_CURLU
+    const char *query;
+    size_t path_len;
+
+    if (handle->url == NULL) {
+        assert((handle->url = curl_url_dup(jf_net_server_url())) != NULL);
+    }
+    if ((query = strchr(resource, '?')) == NULL) {
+        path_len = strlen(resource);
+    } else {
+        path_len = (size_t)(query - resource);
+        query++;
+    }
+    jf_growing_buffer_append(buffer, s_server_path, s_server_path_len);
+    jf_growing_buffer_append(buffer, resource, path_len);
+    if (curl_url_set(handle->url, CURLUPART_PATH, jf_growing_buffer_cstr(buffer), 0) != CURLUE_OK
+            || curl_url_set(handle->url, CURLUPART_QUERY, query, 0) != CURLUE_OK) {
+        fprintf(stderr, "FATAL: could not set URL for resource %s.\n", resource);
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    JF_CURL_ASSERT(curl_easy_setopt(handle->curl, CURLOPT_CURLU, handle->url));
+#else
+    jf_growing_buffer_append(buffer, g_options.server, g_options.server_len);
+    jf_growing_buffer_append(buffer, resource, 0);
+    JF_CURL_ASSERT(curl_easy_setopt(handle->curl, CURLOPT_URL, jf_growing_buffer_cstr(buffer)));
+#endif
+}
+
+
+static void jf_net_handle_before_perform(jf_net_handle *net_handle,
         const char *resource,
         const jf_request_type request_type,
         const jf_http_method method,
         const char *payload,
         const jf_reply *reply)
 {
-    char *url;
+    CURL *handle = net_handle->curl;
 
     // url
     if (request_type == JF_REQUEST_CHECK_UPDATE) {
+#if JF_NET_HAS_CURLU
+        // CURLOPT_CURLU would take precedence over CURLOPT_URL
+        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_CURLU, NULL));
+#endif
         JF_CURL_ASSERT(curl_easy_setopt(handle,
                     CURLOPT_URL,
                     "https://github.com/Aanok/jftui/releases/latest"));
     } else {
-        url = jf_concat(2, g_options.server, resource);
-        JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_URL, url));
-        free(url);
+        jf_net_handle_set_url(net_handle, resource);
     }
 
     // HTTP method and headers
@@ -434,13 +624,17 @@ static void jf_net_handle_before_perform(CURL *handle,
     switch (request_type) {
         case JF_REQUEST_IN_MEMORY:
         case JF_REQUEST_ASYNC_IN_MEMORY:
+        case JF_REQUEST_ASYNC_PREFETCH:
+        case JF_REQUEST_ASYNC_DOWNLOAD:
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, jf_reply_callback));
             break;
         case JF_REQUEST_SAX_PROMISCUOUS:
+        case JF_REQUEST_ASYNC_SAX_PROMISCUOUS:
             s_tb.promiscuous_context = true;
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, jf_thread_buffer_callback));
             break;
         case JF_REQUEST_SAX:
+        case JF_REQUEST_ASYNC_SAX:
             s_tb.promiscuous_context = false;
             JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, jf_thread_buffer_callback));
             break;
@@ -462,13 +656,30 @@ static void jf_net_handle_before_perform(CURL *handle,
 }
 
 
-static void jf_net_handle_after_perform(CURL *handle,
+static void jf_net_handle_after_perform(jf_net_handle *net_handle,
         const CURLcode result,
         const jf_request_type request_type,
         jf_reply *reply)
 {
+    CURL *handle = net_handle->curl;
     long status_code;
 
+    jf_net_handle_record_stats(net_handle, result, request_type);
+    atomic_store(&s_last_transfer_us, jf_stats_now_us());
+
+#if JF_NET_HAS_CURLU
+    // older libcurl writes redirect targets back into the CURLU handle:
+    // start over from the server address next time
+    if (net_handle->url != NULL && request_type != JF_REQUEST_CHECK_UPDATE) {
+        long redirect_count = 0;
+        curl_easy_getinfo(handle, CURLINFO_REDIRECT_COUNT, &redirect_count);
+        if (redirect_count > 0) {
+            curl_url_cleanup(net_handle->url);
+            net_handle->url = NULL;
+        }
+    }
+#endif
+
     if (request_type == JF_REQUEST_ASYNC_DETACH || reply == NULL) {
         jf_reply_free(reply);
         return;
@@ -479,7 +690,11 @@ static void jf_net_handle_after_perform(CURL *handle,
         JF_CURL_ASSERT(curl_easy_setopt(handle, CURLOPT_HEADERDATA, NULL));
     }
 
-    if (result != CURLE_OK) {
+    if (result == CURLE_ABORTED_BY_CALLBACK && atomic_load(&reply->cancelled)) {
+        free(reply->payload);
+        reply->payload = NULL;
+        reply->state = JF_REPLY_ERROR_CANCELLED;
+    } else if (result != CURLE_OK) {
         // don't overwrite error messages we've already set ourselves
         if (! JF_REPLY_PTR_HAS_ERROR(reply)) {
             free(reply->payload);
@@ -487,7 +702,7 @@ static void jf_net_handle_after_perform(CURL *handle,
             reply->state = JF_REPLY_ERROR_NETWORK;
         }
     } else {
-        if (request_type == JF_REQUEST_SAX_PROMISCUOUS || request_type == JF_REQUEST_SAX) {
+        if (JF_REQUEST_TYPE_IS_SAX(request_type)) {
             jf_thread_buffer_wait_parsing_done();
         }
         // request went well but check for http error
@@ -520,6 +735,52 @@ static void jf_net_handle_after_perform(CURL *handle,
 }
 
 
+static void jf_net_handle_record_stats(jf_net_handle *net_handle,
+        const CURLcode result,
+        const jf_request_type request_type)
+{
+    jf_stats_net_sample sample = { 0 };
+    long status_code = 0;
+    // cumulative since the start of the transfer
+    uint64_t namelookup, connect, appconnect, pretransfer, starttransfer, total;
+
+#if LIBCURL_VERSION_NUM >= 0x073d00
+    // libcurl 7.61.0 introduced the microsecond _T variants
+    curl_off_t t;
+#define JF_NET_GETINFO_US(_info, _dst)                                      \
+    _dst = curl_easy_getinfo(net_handle->curl, _info ## _T, &t) == CURLE_OK \
+        && t > 0 ? (uint64_t)t : 0
+    JF_NET_GETINFO_US(CURLINFO_SIZE_DOWNLOAD, sample.bytes_received);
+#else
+    double t;
+#define JF_NET_GETINFO_US(_info, _dst)                                      \
+    _dst = curl_easy_getinfo(net_handle->curl, _info, &t) == CURLE_OK       \
+        && t > 0 ? (uint64_t)(t * 1000000) : 0
+    sample.bytes_received = curl_easy_getinfo(net_handle->curl,
+            CURLINFO_SIZE_DOWNLOAD, &t) == CURLE_OK && t > 0 ? (uint64_t)t : 0;
+#endif
+    JF_NET_GETINFO_US(CURLINFO_NAMELOOKUP_TIME, namelookup);
+    JF_NET_GETINFO_US(CURLINFO_CONNECT_TIME, connect);
+    JF_NET_GETINFO_US(CURLINFO_APPCONNECT_TIME, appconnect);
+    JF_NET_GETINFO_US(CURLINFO_PRETRANSFER_TIME, pretransfer);
+    JF_NET_GETINFO_US(CURLINFO_STARTTRANSFER_TIME, starttransfer);
+    JF_NET_GETINFO_US(CURLINFO_TOTAL_TIME, total);
+#undef JF_NET_GETINFO_US
+
+    // phases are 0 on a reused connection; appconnect is 0 without TLS
+    sample.phase_us[JF_STATS_NET_DNS] = namelookup;
+    sample.phase_us[JF_STATS_NET_CONNECT] = connect > namelookup ? connect - namelookup : 0;
+    sample.phase_us[JF_STATS_NET_TLS] = appconnect > connect ? appconnect - connect : 0;
+    sample.phase_us[JF_STATS_NET_TTFB] = starttransfer > pretransfer ? starttransfer - pretransfer : 0;
+    sample.phase_us[JF_STATS_NET_TOTAL] = total;
+
+    curl_easy_getinfo(net_handle->curl, CURLINFO_RESPONSE_CODE, &status_code);
+    sample.failed = result != CURLE_OK || status_code >= 400;
+
+    jf_stats_net_record(request_type, &sample);
+}
+
+
 jf_reply *jf_net_request(const char *resource,
         const jf_request_type request_type,
         const jf_http_method method,
@@ -527,6 +788,7 @@ jf_reply *jf_net_request(const char *resource,
 {
     jf_reply *reply;
     jf_async_request *a_r;
+    uint64_t trace_start;
     
     if (request_type == JF_REQUEST_EXIT) {
         reply = jf_reply_new();
@@ -544,9 +806,10 @@ jf_reply *jf_net_request(const char *resource,
                 method,
                 payload);
         reply = a_r->reply;
-        jf_synced_queue_enqueue(s_async_queue, a_r);
+        jf_async_request_enqueue(a_r);
     } else {
         reply = jf_reply_new();
+        trace_start = jf_trace_begin();
         jf_net_handle_before_perform(s_handle,
                 resource,
                 request_type,
@@ -554,9 +817,10 @@ jf_reply *jf_net_request(const char *resource,
                 payload,
                 reply);
         jf_net_handle_after_perform(s_handle,
-                curl_easy_perform(s_handle),
+                curl_easy_perform(s_handle->curl),
                 request_type,
                 reply);
+        jf_trace_end("net", "jf_net_request", trace_start, resource);
     }
 
     return reply;
@@ -582,6 +846,11 @@ static jf_async_request *jf_async_request_new(const char *resource,
         assert((a_r->resource = strdup(resource)) != NULL);
     }
     a_r->type = request_type;
+    a_r->priority = jf_request_type_get_priority(request_type);
+    a_r->generation = atomic_load(&s_prefetch_generation);
+    a_r->enqueued_us = jf_trace_begin();
+    a_r->next = NULL;
+    a_r->destination = NULL;
     a_r->method = method;
     switch (method) {
         case JF_HTTP_GET:
@@ -609,10 +878,162 @@ static void jf_async_request_free(jf_async_request *a_r)
     if (a_r == NULL) return;
     free(a_r->resource);
     free(a_r->payload);
+    free(a_r->destination);
     free(a_r);
 }
 
 
+static inline jf_request_priority jf_request_type_get_priority(const jf_request_type type)
+{
+    switch (type) {
+        case JF_REQUEST_ASYNC_PREFETCH:
+        case JF_REQUEST_ASYNC_DOWNLOAD:
+            return JF_REQUEST_PRIORITY_PREFETCH;
+        case JF_REQUEST_ASYNC_DETACH:
+        case JF_REQUEST_CHECK_UPDATE:
+        case JF_REQUEST_EXIT:
+            return JF_REQUEST_PRIORITY_BACKGROUND;
+        default:
+            return JF_REQUEST_PRIORITY_INTERACTIVE;
+    }
+}
+
+
+static void jf_async_request_enqueue(jf_async_request *a_r)
+{
+    jf_synced_queue_enqueue(s_async_queues[a_r->priority], a_r);
+    assert(sem_post(&s_async_sem) == 0);
+}
+
+
+static jf_async_request *jf_async_request_dequeue(void)
+{
+    jf_async_request *a_r;
+    int i;
+
+    while (sem_wait(&s_async_sem) != 0) {
+        // EINTR
+    }
+    // the semaphore guarantees a request is there, but its enqueue may still
+    // be in flight: keep looking
+    while (true) {
+        for (i = 0; i < JF_REQUEST_PRIORITY_COUNT; i++) {
+            if ((a_r = jf_synced_queue_poll(s_async_queues[i])) != NULL) {
+                return a_r;
+            }
+        }
+        sched_yield();
+    }
+}
+
+
+static void jf_async_request_store_download(jf_async_request *a_r)
+{
+    char suffix[sizeof(".part") + 20];
+    char *part_path;
+    FILE *file;
+    bool ok;
+
+    if (a_r->reply->state == JF_REPLY_SUCCESS) {
+        // per request, in case the same file is being downloaded twice
+        snprintf(suffix, sizeof(suffix), ".part%zu", a_r->id);
+        part_path = jf_concat(2, a_r->destination, suffix);
+        if ((file = fopen(part_path, "w")) != NULL) {
+            ok = a_r->reply->size == 0
+                || fwrite(a_r->reply->payload, a_r->reply->size, 1, file) == 1;
+            ok = fclose(file) == 0 && ok;
+            if (! ok || rename(part_path, a_r->destination) != 0) {
+                unlink(part_path);
+            }
+        }
+        free(part_path);
+    }
+    jf_reply_free(a_r->reply);
+    a_r->reply = NULL;
+}
+
+
+static void jf_async_request_notify_done(void)
+{
+    const uint64_t one = 1;
+
+    // under the lock, so that a waiter can't miss it between checking the
+    // reply state and going to sleep
+    pthread_mutex_lock(&s_async_mut);
+    assert(pthread_cond_broadcast(&s_async_cv) == 0);
+    pthread_mutex_unlock(&s_async_mut);
+    // the counter saturating is no concern: readers only need it nonzero
+    if (write(s_async_done_fd, &one, sizeof(one)) == -1) {}
+}
+
+
+static bool jf_async_request_is_cancelled(jf_async_request *a_r)
+{
+    if (a_r->reply == NULL) return false;
+    if (a_r->priority == JF_REQUEST_PRIORITY_PREFETCH
+            && a_r->generation != atomic_load(&s_prefetch_generation)) {
+        atomic_store(&a_r->reply->cancelled, true);
+    }
+    return atomic_load(&a_r->reply->cancelled);
+}
+
+
+static int jf_net_xferinfo_callback(void *clientp,
+        __attribute__((unused)) curl_off_t dltotal,
+        __attribute__((unused)) curl_off_t dlnow,
+        __attribute__((unused)) curl_off_t ultotal,
+        __attribute__((unused)) curl_off_t ulnow)
+{
+    jf_async_request *a_r = (jf_async_request *)clientp;
+
+    // nonzero aborts the transfer with CURLE_ABORTED_BY_CALLBACK
+    // detached requests (progress reports, played marks) must still go out
+    // while exiting: jf_detach_callback stops reading their response instead
+    return (JF_STATE_IS_EXITING(g_state.state) && a_r->type != JF_REQUEST_ASYNC_DETACH)
+        || jf_async_request_is_cancelled(a_r);
+}
+
+
+void jf_net_cancel(jf_reply *r)
+{
+    if (r == NULL) return;
+    atomic_store(&r->cancelled, true);
+}
+
+
+void jf_net_cancel_prefetches(void)
+{
+    atomic_fetch_add(&s_prefetch_generation, 1);
+}
+
+
+void jf_net_prewarm(void)
+{
+    uint64_t now = jf_stats_now_us();
+    uint_fast64_t last = atomic_load(&s_last_transfer_us);
+
+    if (last != 0 && now - last < JF_NET_PREWARM_IDLE_SECS * 1000000ull) return;
+    if (s_prewarm_reply != NULL) {
+        // still on its way: no need for another
+        if (! jf_net_is_done(s_prewarm_reply)) return;
+        jf_reply_free(s_prewarm_reply);
+        s_prewarm_reply = NULL;
+    }
+    // claim it, so that repeated calls don't queue a stampede
+    if (! atomic_compare_exchange_strong(&s_last_transfer_us, &last, now)) return;
+
+    // speculative: the view the user navigates to may as well connect
+    // on its own
+    s_prewarm_reply = jf_net_request(JF_NET_PREWARM_RESOURCE, JF_REQUEST_ASYNC_PREFETCH, JF_HTTP_GET, NULL);
+}
+
+
+void jf_net_set_cainfo(const char *path)
+{
+    s_cainfo = path;
+}
+
+
 static size_t jf_detach_callback(__attribute__((unused)) char *payload,
         size_t size,
         size_t nmemb,
@@ -628,10 +1049,15 @@ static size_t jf_detach_callback(__attribute__((unused)) char *payload,
 
 static void *jf_net_async_worker_thread(__attribute__((unused)) void *arg)
 {
-    CURL *handle;
-    jf_async_request *request;
+    jf_net_handle *handle;
+    jf_async_request *request, *next;
+    uint64_t trace_start;
 
+    jf_trace_thread_name("net worker");
     handle = jf_net_handle_init();
+    // cancellation checks
+    JF_CURL_ASSERT(curl_easy_setopt(handle->curl, CURLOPT_XFERINFOFUNCTION, jf_net_xferinfo_callback));
+    JF_CURL_ASSERT(curl_easy_setopt(handle->curl, CURLOPT_NOPROGRESS, 0L));
 
     // block signals we handle in main thread
     {
@@ -644,24 +1070,48 @@ static void *jf_net_async_worker_thread(__attribute__((unused)) void *arg)
     }
 
     while (true) {
-        request = (jf_async_request *)jf_synced_queue_dequeue(s_async_queue);
+        request = jf_async_request_dequeue();
+        trace_start = jf_trace_begin();
+        jf_trace_end_span("net", "queued", request->enqueued_us, trace_start, request->resource);
         if (request->type == JF_REQUEST_EXIT) {
             jf_async_request_free(request);
-            curl_easy_cleanup(handle);
+            jf_net_handle_free(handle);
             pthread_exit(NULL);
         }
-        jf_net_handle_before_perform(handle,
-                request->resource,
-                request->type,
-                request->method,
-                request->payload,
-                request->reply);
-        jf_net_handle_after_perform(handle,
-                curl_easy_perform(handle),
-                request->type,
-                request->reply);
-        jf_async_request_free(request);
-        assert(pthread_cond_broadcast(&s_async_cv) == 0);
+        if (jf_async_request_is_cancelled(request)) {
+            jf_trace_instant("net", "cancelled", request->resource);
+            request->reply->state = JF_REPLY_ERROR_CANCELLED;
+            if (request->type == JF_REQUEST_ASYNC_DOWNLOAD) {
+                // nobody else holds the reply
+                jf_async_request_store_download(request);
+            }
+            jf_async_request_free(request);
+            jf_async_request_notify_done();
+            continue;
+        }
+        // more than one iteration only for a jf_net_batch
+        while (request != NULL) {
+            JF_CURL_ASSERT(curl_easy_setopt(handle->curl, CURLOPT_XFERINFODATA, (void *)request));
+            jf_net_handle_before_perform(handle,
+                    request->resource,
+                    request->type,
+                    request->method,
+                    request->payload,
+                    request->reply);
+            jf_net_handle_after_perform(handle,
+                    curl_easy_perform(handle->curl),
+                    request->type,
+                    request->reply);
+            jf_trace_end("net", "jf_net_request (async)", trace_start, request->resource);
+            if (request->type == JF_REQUEST_ASYNC_DOWNLOAD) {
+                jf_async_request_store_download(request);
+            }
+            trace_start = jf_trace_begin();
+            next = request->next;
+            jf_async_request_free(request);
+            request = next;
+        }
+        jf_async_request_notify_done();
     }
 }
 
@@ -724,6 +1174,36 @@ static void jf_net_share_unlock(__attribute__((unused)) CURL *handle,
 }
 
 
+void jf_net_batch_add(jf_net_batch *batch,
+        const char *resource,
+        const jf_http_method method,
+        const char *payload)
+{
+    jf_async_request *a_r;
+
+    a_r = jf_async_request_new(resource, JF_REQUEST_ASYNC_DETACH, method, payload);
+    if (batch->head == NULL) {
+        batch->head = a_r;
+    } else {
+        batch->tail->next = a_r;
+    }
+    batch->tail = a_r;
+    batch->count++;
+}
+
+
+void jf_net_batch_flush(jf_net_batch *batch)
+{
+    if (batch->head == NULL) return;
+
+    if (s_handle == NULL) {
+        jf_net_init();
+    }
+    jf_async_request_enqueue(batch->head);
+    *batch = (jf_net_batch){ 0 };
+}
+
+
 jf_reply *jf_net_await(jf_reply *reply)
 {
     assert(reply != NULL);
@@ -734,6 +1214,40 @@ jf_reply *jf_net_await(jf_reply *reply)
     pthread_mutex_unlock(&s_async_mut);
     return reply;
 }
+
+
+bool jf_net_is_done(jf_reply *reply)
+{
+    bool done;
+
+    assert(reply != NULL);
+    pthread_mutex_lock(&s_async_mut);
+    done = reply->state != JF_REPLY_PENDING;
+    pthread_mutex_unlock(&s_async_mut);
+    return done;
+}
+
+
+void jf_net_download(const char *resource, const char *destination)
+{
+    jf_async_request *a_r;
+
+    if (s_handle == NULL) {
+        jf_net_init();
+    }
+    a_r = jf_async_request_new(resource, JF_REQUEST_ASYNC_DOWNLOAD, JF_HTTP_GET, NULL);
+    assert((a_r->destination = strdup(destination)) != NULL);
+    jf_async_request_enqueue(a_r);
+}
+
+
+int jf_net_async_done_fd(void)
+{
+    if (s_handle == NULL) {
+        jf_net_init();
+    }
+    return s_async_done_fd;
+}
 //////////////////////////////////////
 
 
@@ -778,7 +1292,7 @@ char *jf_net_urlencode(const char *url)
 {
     char *tmp, *retval;
     assert(s_handle != NULL);
-    assert((tmp = curl_easy_escape(s_handle, url, 0)) != NULL);
+    assert((tmp = curl_easy_escape(s_handle->curl, url, 0)) != NULL);
     retval = strdup(tmp);
     curl_free(tmp);
     assert(retval != NULL);
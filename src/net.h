@@ -2,9 +2,13 @@
 #define _JF_NET
 
 
+#include "shared.h"
+
 #include <stddef.h>
 #include <stdbool.h>
 
+#include <curl/curl.h>
+
 
 ////////// CODE MACROS //////////
 #define JF_CURL_ASSERT(_s)                                                  \
@@ -34,6 +38,11 @@ do {                                                                        \
 
 ////////// CONSTANTS /////////
 #define JF_NET_ASYNC_THREADS 3
+// jf_net_prewarm reconnects after this long without transfers: curl drops
+// cached connections idle for 118s and servers tend to time out even sooner
+#define JF_NET_PREWARM_IDLE_SECS 30
+// unauthenticated and tiny on both Jellyfin and Emby
+#define JF_NET_PREWARM_RESOURCE "/system/info/public"
 //////////////////////////////
 
 ////////// JF_REPLY //////////
@@ -50,6 +59,7 @@ typedef enum __attribute__((__packed__)) jf_reply_state {
     JF_REPLY_ERROR_BAD_LOCATION = -7,
     JF_REPLY_ERROR_EXIT_REQUEST = -8,
     JF_REPLY_ERROR_NETWORK = -9,
+    JF_REPLY_ERROR_CANCELLED = -10,
 
     JF_REPLY_ERROR_HTTP_400 = -32,
     JF_REPLY_ERROR_HTTP_NOT_OK = -33,
@@ -61,6 +71,8 @@ typedef struct jf_reply {
     char *payload;
     size_t size;
     jf_reply_state state;
+    // set through jf_net_cancel, async requests only
+    atomic_bool cancelled;
 } jf_reply;
 
 
@@ -86,6 +98,24 @@ void jf_net_clear(void);
 
 
 ////////// NETWORKING //////////
+// libcurl 7.63.0 introduced CURLOPT_CURLU
+#define JF_NET_HAS_CURLU (LIBCURL_VERSION_NUM >= 0x073f00)
+
+
+// An easy handle paired with the URL state it keeps across requests.
+// With CURLU support, url holds a copy of the pre-parsed server address
+// (scheme, host, port, base path) so each request only sets path and query.
+// It stays NULL until the first request to the server. Otherwise, the full
+// URL is rebuilt in url_buffer.
+typedef struct jf_net_handle {
+    CURL *curl;
+#if JF_NET_HAS_CURLU
+    CURLU *url;
+#endif
+    jf_growing_buffer *url_buffer;
+} jf_net_handle;
+
+
 typedef enum jf_request_type {
     JF_REQUEST_IN_MEMORY = 0,
     JF_REQUEST_SAX = 1,
@@ -94,11 +124,37 @@ typedef enum jf_request_type {
     JF_REQUEST_ASYNC_IN_MEMORY = -1,
     JF_REQUEST_ASYNC_DETACH = -2,
     JF_REQUEST_CHECK_UPDATE = -3,
+    JF_REQUEST_ASYNC_PREFETCH = -4,
+    JF_REQUEST_ASYNC_SAX = -5,
+    JF_REQUEST_ASYNC_SAX_PROMISCUOUS = -6,
+    // through jf_net_download only
+    JF_REQUEST_ASYNC_DOWNLOAD = -7,
 
     JF_REQUEST_EXIT = -100
 } jf_request_type;
 
 #define JF_REQUEST_TYPE_IS_ASYNC(_t) ((_t) < 0)
+#define JF_REQUEST_TYPE_IS_SAX(_t)                                  \
+    ((_t) == JF_REQUEST_SAX || (_t) == JF_REQUEST_SAX_PROMISCUOUS   \
+     || (_t) == JF_REQUEST_ASYNC_SAX                                \
+     || (_t) == JF_REQUEST_ASYNC_SAX_PROMISCUOUS)
+
+
+// Async requests are served strictly by priority class, FIFO within a class.
+// The class is implied by the request type:
+//  - INTERACTIVE: JF_REQUEST_ASYNC_IN_MEMORY and JF_REQUEST_ASYNC_SAX_*,
+//      someone is waiting on it;
+//  - PREFETCH: JF_REQUEST_ASYNC_PREFETCH and JF_REQUEST_ASYNC_DOWNLOAD,
+//      speculative, dropped by jf_net_cancel_prefetches;
+//  - BACKGROUND: JF_REQUEST_ASYNC_DETACH and JF_REQUEST_CHECK_UPDATE
+//      (progress reports, played marks...).
+typedef enum jf_request_priority {
+    JF_REQUEST_PRIORITY_INTERACTIVE = 0,
+    JF_REQUEST_PRIORITY_PREFETCH = 1,
+    JF_REQUEST_PRIORITY_BACKGROUND = 2
+} jf_request_priority;
+
+#define JF_REQUEST_PRIORITY_COUNT 3
 
 
 typedef enum jf_http_method {
@@ -132,6 +188,14 @@ typedef enum jf_http_method {
 //          while a separate thread takes care of network traffic. The response
 //          will be passed back in a jf_reply struct. The caller may use
 //          jf_net_async_await to wait until the request is fully evaded.
+//      - JF_REQUEST_ASYNC_PREFETCH works like JF_REQUEST_ASYNC_IN_MEMORY but
+//          is served after all pending interactive requests and is cancelled
+//          in bulk by jf_net_cancel_prefetches.
+//      - JF_REQUEST_ASYNC_SAX and JF_REQUEST_ASYNC_SAX_PROMISCUOUS work like
+//          their blocking counterparts, with the transfer and the wait for
+//          the parser happening on a separate thread: the reply is no longer
+//          pending once parsing is done. Only one SAX request of any kind may
+//          be in flight at a time, as they share the parser.
 //      - JF_REQUEST_ASYNC_DETACH will likewise work asynchronously; however,
 //          the function will immediately return NULL and all response data
 //          will be discarded on arrival. Use for requests whose outcome you
@@ -153,8 +217,8 @@ typedef enum jf_http_method {
 //  - marks an error (authentication, network, parser's, internal), check with
 //      the JF_REPLY_PTR_HAS_ERROR macro and get an error string with
 //      jf_reply_error_string;
-//  - contains the body of the response for a JF_REQUEST_[ASYNC_]IN_MEMORY and
-//      JF_REQUEST_CHECK_UPDATE.
+//  - contains the body of the response for a JF_REQUEST_[ASYNC_]IN_MEMORY,
+//      JF_REQUEST_ASYNC_PREFETCH and JF_REQUEST_CHECK_UPDATE.
 //  - contains an empty body for JF_REQUEST_SAX_*;
 //  - is NULL for JF_REQUEST_ASYNC_DETACH.
 // CAN FATAL.
@@ -170,13 +234,112 @@ typedef struct jf_async_request {
     jf_reply *reply;
     char *resource;
     jf_request_type type;
+    jf_request_priority priority;
     jf_http_method method;
     char *payload;
     size_t id;
+    // value of the prefetch generation when enqueued: a prefetch from an
+    // older generation is stale
+    size_t generation;
+    // jf_trace_begin() when created, to trace time spent queued
+    uint64_t enqueued_us;
+    // further requests of the same jf_net_batch, performed right after
+    struct jf_async_request *next;
+    // JF_REQUEST_ASYNC_DOWNLOAD only: where the body goes
+    char *destination;
 } jf_async_request;
 
 
+// A chain of detached requests that is queued as a single unit: the worker
+// that picks it up performs them back to back on its own handle, so they
+// share one connection and don't interleave with other traffic.
+typedef struct jf_net_batch {
+    jf_async_request *head;
+    jf_async_request *tail;
+    size_t count;
+} jf_net_batch;
+
+
 jf_reply *jf_net_await(jf_reply *r);
+
+
+// Returns:
+//  true if jf_net_await would return right away on r.
+// CAN'T FAIL.
+bool jf_net_is_done(jf_reply *r);
+
+
+// Returns:
+//  An eventfd that becomes readable whenever async requests complete, so that
+//  replies can be waited on in a poll loop together with other fds. Reading
+//  it rearms it. Completions are not tied to any particular reply: check
+//  with jf_net_is_done.
+// CAN FATAL.
+int jf_net_async_done_fd(void);
+
+
+// Appends a JF_REQUEST_ASYNC_DETACH request to batch. Nothing is sent until
+// jf_net_batch_flush.
+//
+// Parameters:
+//  - batch: must be zero-initialized before the first add.
+//  - resource, method, payload: as per jf_net_request (they are copied).
+// CAN FATAL.
+void jf_net_batch_add(jf_net_batch *batch,
+        const char *resource,
+        const jf_http_method method,
+        const char *payload);
+
+
+// Queues all requests in batch and empties it. No-op on an empty batch.
+// CAN FATAL.
+void jf_net_batch_flush(jf_net_batch *batch);
+
+
+// Fetches resource (as per jf_net_request) in the background and stores the
+// response body at destination. The file is written under a temporary name
+// and renamed into place, so destination either doesn't exist or is
+// complete. Nothing is stored on failure or cancellation, and nobody is told:
+// check for the file. Served and cancelled like a prefetch.
+// CAN FATAL.
+void jf_net_download(const char *resource, const char *destination);
+
+
+// Requests cancellation of an async request. If it is still queued it will be
+// dropped; if it is in flight, the transfer is aborted from the progress
+// callback. Either way the reply ends in state JF_REPLY_ERROR_CANCELLED
+// unless it completed first. The caller must still jf_net_await the reply
+// before freeing it.
+//
+// Parameters:
+//  - r: reply of a JF_REQUEST_ASYNC_IN_MEMORY or JF_REQUEST_ASYNC_PREFETCH
+//      request (NULL is a no-op).
+// CAN'T FAIL.
+void jf_net_cancel(jf_reply *r);
+
+
+// Cancels all JF_REQUEST_ASYNC_PREFETCH and jf_net_download requests issued
+// so far, as per jf_net_cancel. Meant for when the user navigates away from
+// whatever they were prefetched for.
+// CAN'T FAIL.
+void jf_net_cancel_prefetches(void);
+
+
+// If nothing has gone over the network for JF_NET_PREWARM_IDLE_SECS, fires a
+// JF_REQUEST_ASYNC_PREFETCH request to the server so that the TCP connection, TLS session
+// and HTTP/2 negotiation are already in the shared caches by the time the
+// next real request goes out. Cheap when the connection is fresh: meant to
+// be called whenever the user is at the prompt.
+// CAN'T FAIL.
+void jf_net_prewarm(void);
+
+
+// Makes every handle trust the PEM certificates in path instead of the
+// system store. Meant for the benchmarks, which talk to a mock server with a
+// throwaway certificate; must be called before any request. path is not
+// copied.
+// CAN'T FAIL.
+void jf_net_set_cainfo(const char *path);
 //////////////////////////////////////
 
 
@@ -4,6 +4,7 @@
 #include "json.h"
 #include "net.h"
 #include "menu.h"
+#include "trace.h"
 
 
 #include <stdlib.h>
@@ -17,6 +18,20 @@ extern mpv_handle *g_mpv_ctx;
 //////////////////////////////////////
 
 
+////////// STATIC VARIABLES //////////
+static jf_played_map s_played_map = { 0 };
+// bumped on every jf_playback_load_external_subtitles, so that replies to
+// sub-add commands for a file that is gone are recognized as such
+static uint32_t s_subs_generation = 0;
+// jf_trace_begin() of the last loadfile replacing the current file
+static uint64_t s_loadfile_trace_start = 0;
+static jf_track_table s_tracks = { 0 };
+// jftui playlist position of entry 0 of mpv's playlist, i.e. of the last
+// file loaded replacing the current one; queued entries follow it in order
+static size_t s_mpv_playlist_base = 0;
+//////////////////////////////////////
+
+
 ////////// STATIC FUNCTIONS ///////////////
 // playback_ticks refers to segment referred by id
 static void jf_post_session_update(const char *id,
@@ -28,6 +43,19 @@ static void jf_post_session(const int64_t playback_ticks,
         const char *update_url);
 
 
+// Makes s_played_map track item's parts, all in JF_PLAYED_STATE_UNKNOWN,
+// unless it already does.
+// CAN FATAL.
+static void jf_played_map_reset(const jf_menu_item *item);
+
+
+// Makes s_played_map track item's parts in the played states recorded on
+// them by jf_playback_video_ticks_collect. Unless fresh, a map already
+// tracking item is left alone: it has seen the marks sent since.
+// CAN FATAL.
+static void jf_played_map_seed(const jf_menu_item *item, const bool fresh);
+
+
 // Requests PlaybackPositionTicks for item's additionalparts (if any) and
 // populates the field for item's children. item's own playback_ticks is set to
 // 0.
@@ -40,10 +68,113 @@ static void jf_post_session(const int64_t playback_ticks,
 //  - false: on failure, in which case playback_ticks may have been populated
 //      for some of the children before encountering the failure.
 static inline bool jf_playback_populate_video_ticks(jf_menu_item *item);
+
+
+// The two halves of jf_playback_populate_video_ticks, so that the requests
+// for several items can be in flight at once.
+// jf_playback_video_ticks_request fires a single request for the user data of
+// all additional parts and returns the reply (NULL if there are none) to pass
+// to jf_playback_video_ticks_collect, which awaits and parses it, frees it and
+// returns as jf_playback_populate_video_ticks, recording on each part whether
+// it is played.
+// item must have been through jf_json_parse_video.
+// request_type: JF_REQUEST_ASYNC_IN_MEMORY for the item about to play,
+// JF_REQUEST_ASYNC_PREFETCH for one resolved ahead of time.
+static jf_reply *jf_playback_video_ticks_request(jf_menu_item *item,
+        const jf_request_type request_type);
+
+// Fires the request for item's /videos/{id}/additionalparts, unless the
+// listing item came from told it has a single part, in which case it returns
+// NULL and saves the round trip. request_type as per
+// jf_playback_video_ticks_request.
+// CAN FATAL.
+static jf_reply *jf_playback_additional_parts_request(const jf_menu_item *item,
+        const jf_request_type request_type);
+
+// Starts downloading the external subtitles of item's parts that are not
+// cached yet, so that by the time the file starts they are hopefully on disk.
+// item must have been through jf_json_parse_video.
+// CAN FATAL.
+static void jf_playback_prefetch_subtitles(const jf_menu_item *item);
+static bool jf_playback_video_ticks_collect(jf_menu_item *item, jf_reply *reply);
+
+
+// Appends the audio items following the current one to mpv's playlist, up to
+// JF_PLAYBACK_AUDIO_QUEUE_AHEAD of them. Stops at the first item that is not
+// audio or would need a resume prompt.
+// CAN FATAL.
+static void jf_playback_queue_audio(void);
+
+
+// Issues an async loadfile for url. append: as opposed to replacing what is
+// playing.
+// CAN FATAL.
+static void jf_playback_loadfile(const char *url, const bool append);
+
+// Moves the current item by entries queued ones, mpv having gone on to them
+// on its own.
+// CAN FATAL.
+static void jf_playback_queued_advance(const size_t entries);
+
+
+// Warns that child could not be loaded. If it came from the subtitle cache
+// (cached), the copy is dropped; otherwise the server is asked for a reason.
+// CAN FATAL.
+static void jf_playback_sub_add_failed(const jf_menu_item *child, const bool cached);
+
+
+// Fills s_tracks from a snapshot of mpv's track-list, unless it is valid
+// already. Returns false if mpv could not provide one.
+// CAN FATAL.
+static bool jf_playback_tracks_refresh(void);
+
+
+// Returns the offset in ticks, within the merged file of g_state.now_playing,
+// of the part that playback_ticks falls in.
+// CAN FATAL.
+static long long jf_playback_part_start(const long long playback_ticks);
 ///////////////////////////////////////////
 
 
 ////////// PROGRESS SYNC //////////
+static void jf_played_map_reset(const jf_menu_item *item)
+{
+    size_t i;
+
+    if (s_played_map.count == item->children_count
+            && strcmp(s_played_map.owner_id, item->id) == 0) {
+        return;
+    }
+    if (s_played_map.count < item->children_count) {
+        assert((s_played_map.states = realloc(s_played_map.states,
+                        item->children_count * sizeof(jf_played_state))) != NULL);
+    }
+    for (i = 0; i < item->children_count; i++) {
+        s_played_map.states[i] = JF_PLAYED_STATE_UNKNOWN;
+    }
+    s_played_map.count = item->children_count;
+    strcpy(s_played_map.owner_id, item->id);
+}
+
+
+static void jf_played_map_seed(const jf_menu_item *item, const bool fresh)
+{
+    size_t i;
+
+    if (! fresh
+            && s_played_map.count == item->children_count
+            && strcmp(s_played_map.owner_id, item->id) == 0) {
+        return;
+    }
+    jf_played_map_reset(item);
+    // the first part shares the parent's id and is not fetched
+    for (i = 1; i < item->children_count; i++) {
+        s_played_map.states[i] = item->children[i]->played ?
+            JF_PLAYED_STATE_PLAYED : JF_PLAYED_STATE_UNPLAYED;
+    }
+}
+
+
 static void jf_post_session_update(const char *id,
         int64_t playback_ticks,
         const char *update_url)
@@ -64,6 +195,8 @@ static void jf_post_session(const int64_t playback_ticks,
 {
     size_t i, last_part, current_part;
     int64_t accounted_ticks, current_tick_offset;
+    jf_played_state wanted;
+    jf_net_batch batch = { 0 };
 
     // single-part items are blissfully simple and I lament my toil elsewise
     if (g_state.now_playing->children_count <= 1) {
@@ -98,15 +231,22 @@ static void jf_post_session(const int64_t playback_ticks,
                 update_url);
     g_state.now_playing->playback_ticks = playback_ticks;
     
-    // check if moved across parts and in case update
+    // check if moved across parts and in case update, but only the parts
+    // whose state on the server actually changes, all in one go
     if (last_part == current_part) return;
+    jf_played_map_reset(g_state.now_playing);
     for (i = 0; i < g_state.now_playing->children_count; i++) {
-        if (i < current_part) {
-            jf_menu_mark_played(g_state.now_playing->children[i]);
-        } else if (i > current_part) {
-            jf_menu_mark_unplayed(g_state.now_playing->children[i]);
+        if (i == current_part) continue;
+        wanted = i < current_part ? JF_PLAYED_STATE_PLAYED : JF_PLAYED_STATE_UNPLAYED;
+        if (s_played_map.states[i] == wanted) continue;
+        if (wanted == JF_PLAYED_STATE_PLAYED) {
+            jf_menu_mark_played(g_state.now_playing->children[i], &batch);
+        } else {
+            jf_menu_mark_unplayed(g_state.now_playing->children[i], &batch);
         }
+        s_played_map.states[i] = wanted;
     }
+    jf_net_batch_flush(&batch);
 }
 
 
@@ -129,11 +269,17 @@ void jf_playback_load_external_subtitles()
     char subs_language[4];
     size_t i, j;
     jf_menu_item *child;
-    char *tmp;
+    jf_growing_buffer *url;
+    char *cached_path;
+    const char *source;
+    const char *command[] = { "sub-add", NULL, "auto", NULL, subs_language, NULL };
+    uint64_t reply_userdata;
+    int status;
 
     // external subtitles
     // note: they unfortunately require loadfile to already have been issued
     subs_language[3] = '\0';
+    s_subs_generation++;
     for (i = 0; i < g_state.now_playing->children_count; i++) {
         for (j = 0; j < g_state.now_playing->children[i]->children_count; j++) {
             child = g_state.now_playing->children[i]->children[j];
@@ -146,87 +292,209 @@ void jf_playback_load_external_subtitles()
                         j);
                 continue;
             }
-            tmp = jf_concat(2, g_options.server, child->name);
+            // straight from the server if it's not in the cache yet
+            if ((cached_path = jf_disk_subtitle_get(child->name)) != NULL) {
+                source = cached_path;
+            } else {
+                url = jf_growing_buffer_scratch();
+                jf_growing_buffer_append(url, g_options.server, g_options.server_len);
+                jf_growing_buffer_append(url, child->name, 0);
+                source = jf_growing_buffer_cstr(url);
+            }
             strncpy(subs_language, child->id, 3);
-            const char *command[] = { "sub-add",
-                tmp,
-                "auto",
-                child->id + 3,
-                subs_language,
-                NULL };
-            if (mpv_command(g_mpv_ctx, command) < 0) {
-                jf_reply *r = jf_net_request(child->name,
-                        JF_REQUEST_IN_MEMORY,
-                        JF_HTTP_GET,
-                        NULL);
+            command[1] = source;
+            command[3] = child->id + 3;
+            // part and child index, to find it again on reply
+            reply_userdata = JF_PLAYBACK_REPLY_USERDATA(JF_PLAYBACK_REPLY_SUB_ADD,
+                    s_subs_generation,
+                    (cached_path != NULL ? JF_PLAYBACK_REPLY_SUB_CACHED : 0)
+                        | (i & 0x7FFF) << 16 | (j & 0xFFFF));
+            if ((status = mpv_command_async(g_mpv_ctx, reply_userdata, command)) < 0) {
                 fprintf(stderr,
-                        "Warning: external subtitle %s could not be loaded.\n",
-                        child->id[3] != '\0' ? child->id + 3 : child->name);
-                if (r->state == JF_REPLY_ERROR_HTTP_400) {
-                    fprintf(stderr, "Reason: %s.\n", r->payload);
-                }
-                jf_reply_free(r);
+                        "Warning: external subtitle %s could not be loaded: %s.\n",
+                        child->id[3] != '\0' ? child->id + 3 : child->name,
+                        mpv_error_string(status));
             }
-            free(tmp);
+            free(cached_path);
         }
     }
 
 }
 
 
+static void jf_playback_sub_add_failed(const jf_menu_item *child, const bool cached)
+{
+    jf_reply *r;
+
+    fprintf(stderr,
+            "Warning: external subtitle %s could not be loaded.\n",
+            child->id[3] != '\0' ? child->id + 3 : child->name);
+    if (cached) {
+        // whatever is wrong with the copy, don't keep tripping on it
+        jf_disk_subtitle_drop(child->name);
+        return;
+    }
+    // ask the server why, without holding up mpv meanwhile (child may be
+    // gone by the time the reply is in)
+    r = jf_net_request(child->name, JF_REQUEST_ASYNC_IN_MEMORY, JF_HTTP_GET, NULL);
+    jf_event_loop_await(r);
+    if (r->state == JF_REPLY_ERROR_HTTP_400) {
+        fprintf(stderr, "Reason: %s.\n", r->payload);
+    }
+    jf_reply_free(r);
+}
+
+
+void jf_playback_command_reply(const uint64_t reply_userdata, const int error)
+{
+    size_t i, j;
+
+    switch (JF_PLAYBACK_REPLY_KIND(reply_userdata)) {
+        case JF_PLAYBACK_REPLY_LOADFILE:
+            if (JF_PLAYBACK_REPLY_ARG(reply_userdata) == 0) {
+                jf_trace_end("playback", "loadfile", s_loadfile_trace_start, NULL);
+            }
+            if (error < 0) {
+                fprintf(stderr,
+                        "Warning: loadfile failed: %s.\n",
+                        mpv_error_string(error));
+            }
+            break;
+        case JF_PLAYBACK_REPLY_SUB_ADD:
+            if (error >= 0) break;
+            // the file it was for is gone already
+            if (JF_PLAYBACK_REPLY_GENERATION(reply_userdata) != (s_subs_generation & 0xFFFFFF)
+                    || g_state.now_playing == NULL) {
+                break;
+            }
+            i = (JF_PLAYBACK_REPLY_ARG(reply_userdata) & ~JF_PLAYBACK_REPLY_SUB_CACHED) >> 16;
+            j = JF_PLAYBACK_REPLY_ARG(reply_userdata) & 0xFFFF;
+            if (i >= g_state.now_playing->children_count
+                    || j >= g_state.now_playing->children[i]->children_count) {
+                break;
+            }
+            jf_playback_sub_add_failed(g_state.now_playing->children[i]->children[j],
+                    (JF_PLAYBACK_REPLY_ARG(reply_userdata) & JF_PLAYBACK_REPLY_SUB_CACHED) != 0);
+            break;
+        default:
+            break;
+    }
+}
+
+
+static bool jf_playback_tracks_refresh(void)
+{
+    mpv_node node;
+    mpv_node_list *fields;
+    jf_track *track;
+    int i, j;
+
+    if (s_tracks.valid) return true;
+
+    if (mpv_get_property(g_mpv_ctx, "track-list", MPV_FORMAT_NODE, &node) != 0) return false;
+    if (node.format != MPV_FORMAT_NODE_ARRAY) {
+        mpv_free_node_contents(&node);
+        return false;
+    }
+    if (s_tracks.size < (size_t)node.u.list->num) {
+        s_tracks.size = (size_t)node.u.list->num;
+        assert((s_tracks.tracks = realloc(s_tracks.tracks,
+                        s_tracks.size * sizeof(jf_track))) != NULL);
+    }
+    s_tracks.count = 0;
+    for (i = 0; i < node.u.list->num; i++) {
+        if (node.u.list->values[i].format != MPV_FORMAT_NODE_MAP) continue;
+        fields = node.u.list->values[i].u.list;
+        track = s_tracks.tracks + s_tracks.count;
+        *track = (jf_track){ .id = -1 };
+        for (j = 0; j < fields->num; j++) {
+            if (strcmp(fields->keys[j], "id") == 0
+                    && fields->values[j].format == MPV_FORMAT_INT64) {
+                track->id = fields->values[j].u.int64;
+            } else if (strcmp(fields->keys[j], "type") == 0
+                    && fields->values[j].format == MPV_FORMAT_STRING) {
+                track->is_sub = strcmp(fields->values[j].u.string, "sub") == 0;
+            } else if (strcmp(fields->keys[j], "external") == 0
+                    && fields->values[j].format == MPV_FORMAT_FLAG) {
+                track->is_external = fields->values[j].u.flag;
+            }
+        }
+        if (track->id != -1) s_tracks.count++;
+    }
+    mpv_free_node_contents(&node);
+    s_tracks.valid = true;
+    return true;
+}
+
+
+void jf_playback_tracks_invalidate(void)
+{
+    s_tracks.valid = false;
+}
+
+
+static long long jf_playback_part_start(const long long playback_ticks)
+{
+    size_t i, low, high;
+
+    if (strncmp(s_tracks.owner_id, g_state.now_playing->id, JF_ID_LENGTH) != 0
+            || s_tracks.part_count != g_state.now_playing->children_count) {
+        s_tracks.part_count = g_state.now_playing->children_count;
+        assert((s_tracks.part_ends = realloc(s_tracks.part_ends,
+                        s_tracks.part_count * sizeof(long long))) != NULL);
+        for (i = 0; i < s_tracks.part_count; i++) {
+            s_tracks.part_ends[i] = (i == 0 ? 0 : s_tracks.part_ends[i - 1])
+                + g_state.now_playing->children[i]->runtime_ticks;
+        }
+        memcpy(s_tracks.owner_id, g_state.now_playing->id, JF_ID_LENGTH);
+        s_tracks.owner_id[JF_ID_LENGTH] = '\0';
+    }
+
+    // number of parts over by playback_ticks
+    low = 0;
+    high = s_tracks.part_count;
+    while (low < high) {
+        i = low + (high - low) / 2;
+        if (s_tracks.part_ends[i] <= playback_ticks) {
+            low = i + 1;
+        } else {
+            high = i;
+        }
+    }
+    return low == 0 ? 0 : s_tracks.part_ends[low - 1];
+}
+
+
 void jf_playback_align_subtitle(const int64_t sid)
 {
-    int64_t track_count, track_id, playback_ticks, sub_delay;
+    int64_t playback_ticks, sub_delay;
+    const jf_track *track = NULL;
     size_t i;
-    long long offset_ticks;
-    int success, is_external;
-    bool is_sub;
-    char num[3];
-    char *track_type, *tmp;
+    int success;
+    bool snapshot_was_cached;
 
     if (g_state.now_playing->children_count <= 1) return;
 
     // look for right track
-    if (mpv_get_property(g_mpv_ctx, "track-list/count", MPV_FORMAT_INT64, &track_count) != 0) return;
-    i = 0; // track-numbers are 0-based
-    while (true) {
-        if ((int64_t)i >= track_count) return;
-        success = snprintf(num, 3, "%ld", i);
-        if (success < 0 || success >= 3) {
-            i++;
-            continue;
-        }
-        tmp = jf_concat(3, "track-list/", num, "/id");
-        success = mpv_get_property(g_mpv_ctx, tmp, MPV_FORMAT_INT64, &track_id);
-        free(tmp);
-        if (success != 0) {
-            i++;
-            continue;
+    // the sid change may come before that of the track-list adding it: an
+    // older snapshot gets one more chance
+    snapshot_was_cached = s_tracks.valid;
+    while (track == NULL) {
+        if (! jf_playback_tracks_refresh()) return;
+        for (i = 0; i < s_tracks.count; i++) {
+            if (s_tracks.tracks[i].id == sid && s_tracks.tracks[i].is_sub) {
+                track = s_tracks.tracks + i;
+                break;
+            }
         }
-        tmp = jf_concat(3, "track-list/", num, "/type");
-        success = mpv_get_property(g_mpv_ctx, tmp, MPV_FORMAT_STRING, &track_type);
-        free(tmp);
-        if (success != 0) {
-            i++;
-            continue;
+        if (track == NULL) {
+            if (! snapshot_was_cached) return;
+            snapshot_was_cached = false;
+            jf_playback_tracks_invalidate();
         }
-        is_sub = strcmp(track_type, "sub") == 0;
-        mpv_free(track_type);
-        if (track_id == sid && is_sub) break;
-        i++;
     }
 
-    // check if external
-    tmp = jf_concat(3, "track-list/", num, "/external");
-    success = mpv_get_property(g_mpv_ctx, tmp, MPV_FORMAT_FLAG, &is_external);
-    free(tmp);
-    if (success != 0) {
-        fprintf(stderr, 
-                "Warning: could not align subtitle track to split-file: mpv_get_property (external): %s.\n",
-                mpv_error_string(success));
-        return;
-    }
-    if (is_external) {
+    if (track->is_external) {
         // compute offset
         success = mpv_get_property(g_mpv_ctx, "time-pos", MPV_FORMAT_INT64, &playback_ticks);
         if (success != 0) {
@@ -235,32 +503,18 @@ void jf_playback_align_subtitle(const int64_t sid)
                     mpv_error_string(success));
             return;
         }
-        playback_ticks = JF_SECS_TO_TICKS(playback_ticks);
-        offset_ticks = 0;
-        i = 0;
-        while (i < g_state.now_playing->children_count
-                && offset_ticks + g_state.now_playing->children[i]->runtime_ticks <= playback_ticks) {
-            offset_ticks += g_state.now_playing->children[i]->runtime_ticks;
-            i++;
-        }
-        sub_delay = JF_TICKS_TO_SECS(offset_ticks);
-
-        // apply
-        success = mpv_set_property(g_mpv_ctx, "sub-delay", MPV_FORMAT_INT64, &sub_delay);
-        if (success != 0) {
-            fprintf(stderr,
-                    "Warning: could not align subtitle track to split-file: mpv_set_property: %s.\n",
-                    mpv_error_string(success));
-        }
+        sub_delay = JF_TICKS_TO_SECS(jf_playback_part_start(JF_SECS_TO_TICKS(playback_ticks)));
     } else {
         // internal are graciously aligned by EDL protocol: 0 offset
         sub_delay = 0;
-        success = mpv_set_property(g_mpv_ctx, "sub-delay", MPV_FORMAT_INT64, &sub_delay);
-        if (success != 0) {
-            fprintf(stderr,
-                    "Warning: could not align subtitle track to split-file: mpv_set_property: %s.\n",
-                    mpv_error_string(success));
-        }
+    }
+
+    // apply
+    success = mpv_set_property(g_mpv_ctx, "sub-delay", MPV_FORMAT_INT64, &sub_delay);
+    if (success != 0) {
+        fprintf(stderr,
+                "Warning: could not align subtitle track to split-file: mpv_set_property: %s.\n",
+                mpv_error_string(success));
     }
 }
 ///////////////////////////////
@@ -292,8 +546,8 @@ void jf_playback_play_video(const jf_menu_item *item)
         jf_growing_buffer_append(filename, ";", 1);
     }
     jf_growing_buffer_append(filename, "", 1);
-    const char *loadfile[] = { "loadfile", filename->buf, NULL };
-    JF_MPV_ASSERT(mpv_command(g_mpv_ctx, loadfile));
+    jf_playback_loadfile(filename->buf, false);
+    g_state.playlist_queued = 0;
     jf_growing_buffer_free(filename);
 
     // external subtitles will be loaded at MPV_EVENT_START_FILE
@@ -303,12 +557,14 @@ void jf_playback_play_video(const jf_menu_item *item)
 
 void jf_playback_play_item(jf_menu_item *item)
 {
-    char *request_url;
+    const char *request_url;
     jf_reply *replies[2];
+    uint64_t trace_start;
 
     if (item == NULL) {
         return;
     }
+    jf_trace_instant("playback", "jf_playback_play_item", item->name);
 
     if (JF_ITEM_TYPE_IS_FOLDER(item->type)) {
         fprintf(stderr, "Error: jf_menu_play_item invoked on folder item type. This is a bug.\n");
@@ -318,65 +574,90 @@ void jf_playback_play_item(jf_menu_item *item)
     switch (item->type) {
         case JF_ITEM_TYPE_AUDIO:
         case JF_ITEM_TYPE_AUDIOBOOK:
+            trace_start = jf_trace_begin();
+            jf_menu_ask_resume(item);
+            jf_trace_end("playback", "ask resume", trace_start, NULL);
             if ((request_url = jf_menu_item_get_request_url(item)) == NULL) {
                 jf_end_playback();
                 return;
             }
-            jf_menu_ask_resume(item);
             JF_MPV_ASSERT(mpv_set_property_string(g_mpv_ctx, "title", item->name));
-            const char *loadfile[] = { "loadfile", request_url, NULL };
-            mpv_command(g_mpv_ctx, loadfile); 
+            jf_playback_loadfile(request_url, false);
+            // replacing the file cleared mpv's playlist
+            g_state.playlist_queued = 0;
             jf_menu_item_free(g_state.now_playing);
             g_state.now_playing = item;
-            free(request_url);
+            jf_playback_queue_audio();
             break;
         case JF_ITEM_TYPE_EPISODE:
         case JF_ITEM_TYPE_MOVIE:
             // check if item was already evaded re: split file and versions
+            // (e.g. by jf_playback_resolve_playlist)
             if (item->children_count > 0) {
+                // the played states were recorded when it was resolved
+                jf_played_map_seed(item, false);
+                trace_start = jf_trace_begin();
                 jf_menu_ask_resume(item);
+                jf_trace_end("playback", "ask resume", trace_start, NULL);
                 jf_playback_play_video(item);
+                jf_menu_item_free(g_state.now_playing);
+                g_state.now_playing = item;
             } else {
                 request_url = jf_menu_item_get_request_url(item);
                 replies[0] = jf_net_request(request_url,
                         JF_REQUEST_ASYNC_IN_MEMORY,
                         JF_HTTP_GET,
                         NULL);
-                free(request_url);
-                request_url = jf_concat(3, "/videos/", item->id, "/additionalparts");
-                replies[1] = jf_net_request(request_url,
-                        JF_REQUEST_IN_MEMORY,
-                        JF_HTTP_GET,
-                        NULL);
-                free(request_url);
-                if (JF_REPLY_PTR_HAS_ERROR(replies[1])) {
-                    fprintf(stderr,
-                            "Error: network request for /additionalparts of item %s failed: %s.\n",
-                            item->name,
-                            jf_reply_error_string(replies[1]));
-                    jf_reply_free(replies[1]);
-                    jf_reply_free(jf_net_await(replies[0]));
-                    jf_end_playback();
-                    return;
-                }
-                if (JF_REPLY_PTR_HAS_ERROR(jf_net_await(replies[0]))) {
+                // in flight together with the metadata, if needed at all
+                replies[1] = jf_playback_additional_parts_request(item, JF_REQUEST_ASYNC_IN_MEMORY);
+                trace_start = jf_trace_begin();
+                jf_net_await(replies[0]);
+                jf_trace_end("playback", "metadata", trace_start, NULL);
+                if (JF_REPLY_PTR_HAS_ERROR(replies[0])) {
                     fprintf(stderr,
                             "Error: network request for item %s failed: %s.\n",
                             item->name,
                             jf_reply_error_string(replies[0]));
                     jf_reply_free(replies[0]);
-                    jf_reply_free(replies[1]);
+                    if (replies[1] != NULL) {
+                        jf_net_cancel(replies[1]);
+                        jf_reply_free(jf_net_await(replies[1]));
+                    }
                     jf_end_playback();
                     return;
                 }
-                jf_json_parse_video(item, replies[0]->payload, replies[1]->payload);
+                if (jf_json_parse_video(item, replies[0]->payload) > 1) {
+                    // the listing may be stale and have told a single part
+                    if (replies[1] == NULL) {
+                        replies[1] = jf_playback_additional_parts_request(item, JF_REQUEST_ASYNC_IN_MEMORY);
+                    }
+                    trace_start = jf_trace_begin();
+                    jf_net_await(replies[1]);
+                    jf_trace_end("playback", "additionalparts", trace_start, NULL);
+                    if (JF_REPLY_PTR_HAS_ERROR(replies[1])) {
+                        fprintf(stderr,
+                                "Error: network request for /additionalparts of item %s failed: %s.\n",
+                                item->name,
+                                jf_reply_error_string(replies[1]));
+                        jf_reply_free(replies[0]);
+                        jf_reply_free(replies[1]);
+                        jf_end_playback();
+                        return;
+                    }
+                    jf_json_parse_additional_parts(item, replies[1]->payload);
+                }
                 jf_reply_free(replies[0]);
-                jf_reply_free(replies[1]);
+                if (replies[1] != NULL) jf_reply_free(jf_net_await(replies[1]));
+                jf_playback_prefetch_subtitles(item);
+                trace_start = jf_trace_begin();
                 if (jf_playback_populate_video_ticks(item) == false) {
                     jf_end_playback();
                     return;
                 }
+                jf_trace_end("playback", "part ticks", trace_start, NULL);
+                trace_start = jf_trace_begin();
                 jf_menu_ask_resume(item);
+                jf_trace_end("playback", "ask resume", trace_start, NULL);
                 jf_playback_play_video(item);
                 jf_disk_playlist_replace_item(g_state.playlist_position, item);
                 jf_menu_item_free(g_state.now_playing);
@@ -394,18 +675,69 @@ void jf_playback_play_item(jf_menu_item *item)
 
 static inline bool jf_playback_populate_video_ticks(jf_menu_item *item)
 {
-    jf_reply **replies;
-    char *tmp;
-    size_t i;
-
     if (item == NULL) return true;
     if (item->type != JF_ITEM_TYPE_EPISODE
             && item->type != JF_ITEM_TYPE_MOVIE) return true;
 
+    if (! jf_playback_video_ticks_collect(item,
+                jf_playback_video_ticks_request(item, JF_REQUEST_ASYNC_IN_MEMORY))) {
+        return false;
+    }
+    // whether the parts are played is kept, to diff against when crossing
+    // parts later
+    jf_played_map_seed(item, true);
+    return true;
+}
+
+
+static jf_reply *jf_playback_additional_parts_request(const jf_menu_item *item,
+        const jf_request_type request_type)
+{
+    jf_growing_buffer *url;
+
+    if (item->part_count == 1) return NULL;
+
+    url = jf_growing_buffer_scratch();
+    JF_GROWING_BUFFER_APPEND_LITERAL(url, "/videos/");
+    jf_growing_buffer_append(url, item->id, 0);
+    JF_GROWING_BUFFER_APPEND_LITERAL(url, "/additionalparts");
+    return jf_net_request(jf_growing_buffer_cstr(url),
+            request_type,
+            JF_HTTP_GET,
+            NULL);
+}
+
+
+static void jf_playback_prefetch_subtitles(const jf_menu_item *item)
+{
+    size_t i, j;
+    const jf_menu_item *child;
+    char *path;
+
+    for (i = 0; i < item->children_count; i++) {
+        for (j = 0; j < item->children[i]->children_count; j++) {
+            child = item->children[i]->children[j];
+            if (child->type != JF_ITEM_TYPE_VIDEO_SUB) continue;
+            if ((path = jf_disk_subtitle_missing(child->name)) != NULL) {
+                jf_net_download(child->name, path);
+                free(path);
+            }
+        }
+    }
+}
+
+
+static jf_reply *jf_playback_video_ticks_request(jf_menu_item *item,
+        const jf_request_type request_type)
+{
+    jf_growing_buffer *url;
+    size_t i;
+
     // the Emby interface was designed by a drunk gibbon. to check for
     // a progress marker, we have to request the items corresponding to
     // the additionalparts and look at them individually
-    // ...and each may have its own bookmark!
+    // ...and each may have its own bookmark! at least they all fit in one
+    // query by ids
 
     // parent and first child refer the same ID, thus the same part
     item->children[0]->playback_ticks = item->playback_ticks;
@@ -413,47 +745,155 @@ static inline bool jf_playback_populate_video_ticks(jf_menu_item *item)
     // tick since there may be multiple markers
     item->playback_ticks = 0;
 
+    if (item->children_count <= 1) return NULL;
+
     // now go and get all markers for all parts
-    assert((replies = malloc((item->children_count - 1) * sizeof(jf_menu_item *))) != NULL);
+    url = jf_growing_buffer_scratch();
+    jf_growing_buffer_append(url, g_options.user_prefix, g_options.user_prefix_len);
+    JF_GROWING_BUFFER_APPEND_LITERAL(url, "/items?enableimages=false&ids=");
     for (i = 1; i < item->children_count; i++) {
-        tmp = jf_concat(4,
-                "/users/",
-                g_options.userid,
-                "/items/",
-                item->children[i]->id);
-        replies[i - 1] = jf_net_request(tmp,
-                JF_REQUEST_ASYNC_IN_MEMORY,
+        if (i > 1) JF_GROWING_BUFFER_APPEND_LITERAL(url, ",");
+        jf_growing_buffer_append(url, item->children[i]->id, 0);
+    }
+    return jf_net_request(jf_growing_buffer_cstr(url),
+            request_type,
+            JF_HTTP_GET,
+            NULL);
+}
+
+
+static bool jf_playback_video_ticks_collect(jf_menu_item *item, jf_reply *reply)
+{
+    bool *played;
+    size_t i, found;
+    uint64_t trace_start;
+
+    if (reply == NULL) return true;
+
+    trace_start = jf_trace_begin();
+    jf_net_await(reply);
+    jf_trace_end("playback", "part ticks wait", trace_start, item->id);
+    if (JF_REPLY_PTR_HAS_ERROR(reply)) {
+        fprintf(stderr,
+                "Error: could not fetch resume information for the parts of item %s: %s.\n",
+                item->name,
+                jf_reply_error_string(reply));
+        jf_reply_free(reply);
+        return false;
+    }
+    assert((played = calloc(item->children_count, sizeof(bool))) != NULL);
+    found = jf_json_parse_parts_playback_ticks(item, reply->payload, played);
+    jf_reply_free(reply);
+    if (found != item->children_count - 1) {
+        fprintf(stderr,
+                "Error: the server returned resume information for %zu of the %zu additional parts of item %s.\n",
+                found,
+                item->children_count - 1,
+                item->name);
+        free(played);
+        return false;
+    }
+    for (i = 1; i < item->children_count; i++) {
+        item->children[i]->played = played[i];
+    }
+    free(played);
+    return true;
+}
+///////////////////////////////////
+
+
+////////// PLAYLIST CONTROLS //////////
+void jf_playback_resolve_playlist(const size_t first, const size_t count)
+{
+    jf_menu_item **items;
+    jf_reply **replies, **ticks, *failed;
+    size_t n, i;
+    uint64_t trace_start;
+    jf_request_type request_type;
+
+    if (first == 0 || first > jf_disk_playlist_item_count()) return;
+    n = jf_disk_playlist_item_count() - first + 1;
+    if (n > count) n = count;
+    if (n == 0) return;
+
+    trace_start = jf_trace_begin();
+    assert((items = malloc(n * sizeof(jf_menu_item *))) != NULL);
+    assert((replies = malloc(2 * n * sizeof(jf_reply *))) != NULL);
+    assert((ticks = calloc(n, sizeof(jf_reply *))) != NULL);
+
+    // stage 1: metadata and (unless the listing told a single part)
+    // additionalparts of every unresolved video, all in flight together
+    for (i = 0; i < n; i++) {
+        items[i] = jf_disk_playlist_get_item(first + i);
+        if ((items[i]->type != JF_ITEM_TYPE_EPISODE && items[i]->type != JF_ITEM_TYPE_MOVIE)
+                || items[i]->children_count > 0) {
+            jf_menu_item_free(items[i]);
+            items[i] = NULL;
+            continue;
+        }
+        // only the first item is waited on right away: the others are guesses
+        request_type = i == 0 ? JF_REQUEST_ASYNC_IN_MEMORY : JF_REQUEST_ASYNC_PREFETCH;
+        replies[2 * i] = jf_net_request(jf_menu_item_get_request_url(items[i]),
+                request_type,
                 JF_HTTP_GET,
                 NULL);
-        free(tmp);
+        replies[2 * i + 1] = jf_playback_additional_parts_request(items[i], request_type);
     }
-    for (i = 1; i < item->children_count; i++) {
-        jf_net_await(replies[i - 1]);
-        if (JF_REPLY_PTR_HAS_ERROR(replies[i - 1])) {
-            fprintf(stderr,
-                    "Error: could not fetch resume information for part %zu of item %s: %s.\n",
-                    i + 1,
-                    item->name,
-                    jf_reply_error_string(replies[i - 1]));
-            for (i = 1; i < item->children_count; i++) {
-                if (replies[i - 1] != NULL) {
-                    jf_net_await(replies[i - 1]);
-                    jf_reply_free(replies[i - 1]);
-                }
+
+    // stage 2: parse in playlist order, which is when any version choice
+    // gets asked, and fire the part ticks requests as we go
+    for (i = 0; i < n; i++) {
+        if (items[i] == NULL) continue;
+        failed = NULL;
+        request_type = i == 0 ? JF_REQUEST_ASYNC_IN_MEMORY : JF_REQUEST_ASYNC_PREFETCH;
+        jf_net_await(replies[2 * i]);
+        if (JF_REPLY_PTR_HAS_ERROR(replies[2 * i])) {
+            failed = replies[2 * i];
+        } else if (jf_json_parse_video(items[i], replies[2 * i]->payload) > 1) {
+            // the listing may be stale and have told a single part
+            if (replies[2 * i + 1] == NULL) {
+                replies[2 * i + 1] = jf_playback_additional_parts_request(items[i], request_type);
+            }
+            jf_net_await(replies[2 * i + 1]);
+            if (JF_REPLY_PTR_HAS_ERROR(replies[2 * i + 1])) {
+                failed = replies[2 * i + 1];
+            } else {
+                jf_json_parse_additional_parts(items[i], replies[2 * i + 1]->payload);
             }
-            free(replies);
-            return false;
         }
-        jf_json_parse_playback_ticks(item->children[i], replies[i - 1]->payload);
-        jf_reply_free(replies[i - 1]);
+        if (failed != NULL) {
+            // not fatal: the item will be resolved when its turn comes
+            fprintf(stderr,
+                    "Warning: could not resolve playlist item %s ahead of time: %s.\n",
+                    items[i]->name,
+                    jf_reply_error_string(failed));
+            jf_menu_item_free(items[i]);
+            items[i] = NULL;
+            jf_net_cancel(replies[2 * i + 1]);
+        } else {
+            jf_playback_prefetch_subtitles(items[i]);
+            ticks[i] = jf_playback_video_ticks_request(items[i], request_type);
+        }
+        jf_reply_free(replies[2 * i]);
+        if (replies[2 * i + 1] != NULL) jf_reply_free(jf_net_await(replies[2 * i + 1]));
+    }
+
+    // stage 3: collect the ticks and write the resolved items back
+    for (i = 0; i < n; i++) {
+        if (items[i] == NULL) continue;
+        if (jf_playback_video_ticks_collect(items[i], ticks[i])) {
+            jf_disk_playlist_replace_item(first + i, items[i]);
+        }
+        jf_menu_item_free(items[i]);
     }
+
+    free(items);
     free(replies);
-    return true;
+    free(ticks);
+    jf_trace_end("playback", "resolve playlist", trace_start, NULL);
 }
-///////////////////////////////////
 
 
-////////// PLAYLIST CONTROLS //////////
 bool jf_playback_next()
 {
     if (g_state.playlist_position == jf_disk_playlist_item_count()) {
@@ -472,6 +912,107 @@ bool jf_playback_next()
 }
 
 
+bool jf_playback_next_after_eof(void)
+{
+    if (g_state.playlist_queued == 0) return jf_playback_next();
+
+    // mpv went on to the next entry of its playlist: that is no loop for
+    // it, so there is no decrement to digest either
+    jf_playback_queued_advance(1);
+    return true;
+}
+
+
+void jf_playback_sync_position(void)
+{
+    int64_t mpv_position;
+    size_t position;
+
+    if (g_state.now_playing == NULL || g_state.playlist_queued == 0) return;
+    if (mpv_get_property(g_mpv_ctx, "playlist-pos", MPV_FORMAT_INT64, &mpv_position) != 0
+            || mpv_position < 0) {
+        return;
+    }
+    // anything outside the queue is a leftover of a file since replaced
+    position = s_mpv_playlist_base + (size_t)mpv_position;
+    if (position <= g_state.playlist_position
+            || position > g_state.playlist_position + g_state.playlist_queued) {
+        return;
+    }
+    // queued entries mpv skipped, e.g. because they failed to load
+    jf_playback_queued_advance(position - g_state.playlist_position);
+}
+
+
+static void jf_playback_queued_advance(const size_t entries)
+{
+    jf_menu_item *item;
+
+    g_state.playlist_position += entries;
+    g_state.playlist_queued -= entries;
+    item = jf_disk_playlist_get_item(g_state.playlist_position);
+    jf_trace_instant("playback", "gapless next", item->name);
+    JF_MPV_ASSERT(mpv_set_property_string(g_mpv_ctx, "title", item->name));
+    jf_menu_item_free(g_state.now_playing);
+    g_state.now_playing = item;
+    jf_playback_queue_audio();
+}
+
+
+static void jf_playback_loadfile(const char *url, const bool append)
+{
+    const char *loadfile[] = { "loadfile", url, append ? "append" : "replace", NULL };
+
+    if (! append) {
+        s_loadfile_trace_start = jf_trace_begin();
+        s_mpv_playlist_base = g_state.playlist_position;
+    }
+    JF_MPV_ASSERT(mpv_command_async(g_mpv_ctx,
+                JF_PLAYBACK_REPLY_USERDATA(JF_PLAYBACK_REPLY_LOADFILE, 0, append),
+                loadfile));
+}
+
+
+static void jf_playback_queue_audio(void)
+{
+    jf_menu_item *item;
+    const char *request_url;
+    size_t n;
+
+    while (g_state.playlist_queued < JF_PLAYBACK_AUDIO_QUEUE_AHEAD) {
+        // never past the end: wrapping around is up to jf_playback_next
+        n = g_state.playlist_position + g_state.playlist_queued + 1;
+        if (n > jf_disk_playlist_item_count()) return;
+        item = jf_disk_playlist_get_item(n);
+        if ((item->type != JF_ITEM_TYPE_AUDIO && item->type != JF_ITEM_TYPE_AUDIOBOOK)
+                || item->playback_ticks != 0
+                || (request_url = jf_menu_item_get_request_url(item)) == NULL) {
+            jf_menu_item_free(item);
+            return;
+        }
+        jf_playback_loadfile(request_url, true);
+        g_state.playlist_queued++;
+        jf_menu_item_free(item);
+    }
+}
+
+
+void jf_playback_playlist_extended(void)
+{
+    if (g_state.now_playing == NULL) return;
+
+    switch (g_state.now_playing->type) {
+        case JF_ITEM_TYPE_AUDIO:
+        case JF_ITEM_TYPE_AUDIOBOOK:
+            jf_playback_queue_audio();
+            break;
+        default:
+            // videos are loaded one at a time by jf_playback_next
+            break;
+    }
+}
+
+
 bool jf_playback_previous()
 {
     if (g_state.playlist_position == 1) {
@@ -493,18 +1034,20 @@ void jf_playback_print_playlist(size_t slice_height)
 {
     size_t i, low, high;
     size_t pos = g_state.playlist_position;
+    size_t count = jf_disk_playlist_item_count();
 
     if (slice_height == 0) {
-        slice_height = jf_disk_playlist_item_count();
+        slice_height = count;
     }
     
     low = pos <= slice_height ? 1 : pos - slice_height;
-    high = jf_clamp_zu(g_state.playlist_position + slice_height,
-            pos,
-            jf_disk_playlist_item_count());
+    high = jf_clamp_zu(pos + slice_height, pos, count);
 
 
-    fprintf(stdout, "\n===== jftui playlist =====\n");
+    fprintf(stdout, "\n===== jftui playlist (%zu items) =====\n", count);
+    if (low > 1) {
+        fprintf(stdout, "... (%zu more)\n", low - 1);
+    }
     for (i = low; i < pos; i++) {
         fprintf(stdout, "%zu: %s\n", i, jf_disk_playlist_get_item_name(i)); 
     }
@@ -512,6 +1055,9 @@ void jf_playback_print_playlist(size_t slice_height)
     for (i = pos + 1; i <= high; i++) {
         fprintf(stdout, "%zu: %s\n", i, jf_disk_playlist_get_item_name(i));
     }
+    if (high < count) {
+        fprintf(stdout, "... (%zu more)\n", count - high);
+    }
     fprintf(stdout, "\n");
 }
 ///////////////////////////////////////
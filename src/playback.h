@@ -10,6 +10,92 @@
 #include <stdbool.h>
 
 
+////////// CONSTANTS //////////
+// rows printed before and after the current item by jftui-playlist-print
+// when no explicit height is passed
+#define JF_PLAYBACK_PLAYLIST_SLICE_DEFAULT 10
+
+// playlist items resolved up front by jf_playback_resolve_playlist when
+// playback starts
+#define JF_PLAYBACK_RESOLVE_AHEAD 8
+
+// audio items appended to mpv's playlist ahead of the one playing, so that
+// mpv moves on to them gaplessly (and prefetches the next one)
+#define JF_PLAYBACK_AUDIO_QUEUE_AHEAD 2
+
+// time-pos is sampled this often during playback, and progress is reported to
+// the server when it moved by at least JF_PLAYBACK_PROGRESS_DELTA_SECS since
+// the last report
+#define JF_PLAYBACK_PROGRESS_SAMPLE_SECS 5
+#define JF_PLAYBACK_PROGRESS_DELTA_SECS 10
+///////////////////////////////
+
+
+////////// ASYNC MPV COMMANDS //////////
+// reply_userdata of the mpv_command_async calls issued by playback: the kind
+// of command in the top byte, then a generation and an argument
+typedef enum jf_playback_reply_kind {
+    JF_PLAYBACK_REPLY_LOADFILE = 1,
+    JF_PLAYBACK_REPLY_SUB_ADD = 2
+} jf_playback_reply_kind;
+
+#define JF_PLAYBACK_REPLY_USERDATA(_kind, _gen, _arg)   \
+    (((uint64_t)(_kind) << 56)                          \
+     | ((uint64_t)((_gen) & 0xFFFFFF) << 32)            \
+     | (uint32_t)(_arg))
+#define JF_PLAYBACK_REPLY_KIND(_ud) ((jf_playback_reply_kind)((_ud) >> 56))
+#define JF_PLAYBACK_REPLY_GENERATION(_ud) ((uint32_t)(((_ud) >> 32) & 0xFFFFFF))
+#define JF_PLAYBACK_REPLY_ARG(_ud) ((uint32_t)(_ud))
+
+// in the argument of a JF_PLAYBACK_REPLY_SUB_ADD: the file was local
+#define JF_PLAYBACK_REPLY_SUB_CACHED ((uint32_t)1 << 31)
+////////////////////////////////////////
+
+
+////////// PLAYED MAP //////////
+typedef enum jf_played_state {
+    // never fetched nor sent: always considered out of date
+    JF_PLAYED_STATE_UNKNOWN = 0,
+    JF_PLAYED_STATE_PLAYED = 1,
+    JF_PLAYED_STATE_UNPLAYED = 2
+} jf_played_state;
+
+
+// Last played state known to the server for each part of a split-file item,
+// so that crossing part boundaries only sends the parts that changed.
+typedef struct jf_played_map {
+    char owner_id[JF_ID_LENGTH + 1];
+    jf_played_state *states;
+    size_t count;
+} jf_played_map;
+////////////////////////////////
+
+
+////////// TRACK TABLE //////////
+// What jf_playback_align_subtitle needs of mpv's track-list, fetched in a
+// single MPV_FORMAT_NODE snapshot and kept until mpv reports a change, along
+// with where each part of the current split-file ends.
+typedef struct jf_track {
+    int64_t id;
+    bool is_sub;
+    bool is_external;
+} jf_track;
+
+
+typedef struct jf_track_table {
+    jf_track *tracks;
+    size_t count;
+    size_t size;
+    bool valid;
+    // part_ends[i] is the end of part i of owner_id, in ticks from the start
+    // of the merged file
+    char owner_id[JF_ID_LENGTH + 1];
+    long long *part_ends;
+    size_t part_count;
+} jf_track_table;
+/////////////////////////////////
+
+
 // Update playback progress marker of the currently playing item on the server
 // (as of g_state.now_playing).
 // Detect if we moved across split-file parts since the last such update and
@@ -29,19 +115,66 @@ void jf_playback_update_progress(const int64_t playback_ticks);
 void jf_playback_update_stopped(const int64_t playback_ticks);
 
 
+// Adds the external subtitles of g_state.now_playing to the file that just
+// started. The sub-add commands run in parallel (each may download its file)
+// and their outcome comes back through jf_playback_command_reply.
+// CAN FATAL.
 void jf_playback_load_external_subtitles(void);
 void jf_playback_align_subtitle(const int64_t sid);
 
 
+// To be called when mpv's track-list changes.
+// CAN'T FAIL.
+void jf_playback_tracks_invalidate(void);
+
+
+// Handles MPV_EVENT_COMMAND_REPLY for the async commands issued by playback
+// (see jf_playback_reply_kind). Others are ignored.
+// CAN'T FAIL.
+void jf_playback_command_reply(const uint64_t reply_userdata, const int error);
+
+
+// Resolves up to count playlist items starting at position first (metadata,
+// split-file parts and their resume ticks) with all requests in flight at
+// once, and writes them back to the playlist so that jf_playback_play_item
+// finds them ready. Any version choice is asked here, in playlist order.
+// Requests for items past first go out as JF_REQUEST_ASYNC_PREFETCH.
+// Items that are not videos or are already resolved are left alone; items
+// that fail to resolve are left for jf_playback_play_item to retry.
+//
+// CAN FATAL.
+void jf_playback_resolve_playlist(const size_t first, const size_t count);
+
+
 bool jf_playback_next(void);
+
+// Like jf_playback_next, for when the current item reached its end
+// (MPV_EVENT_END_FILE with MPV_END_FILE_REASON_EOF): if the next item was
+// queued in mpv's playlist, mpv is already playing it and jftui only catches
+// up, without reloading nor counting it as a loop on mpv's side.
+// CAN FATAL.
+bool jf_playback_next_after_eof(void);
+
+// For MPV_EVENT_START_FILE: if mpv started a queued entry past the one jftui
+// takes for current (the entries in between failed to load and were skipped,
+// with no EOF), catches up to it.
+// CAN FATAL.
+void jf_playback_sync_position(void);
 bool jf_playback_previous(void);
 
 
+// To be called after items were appended to the playlist during playback:
+// lets the current audio item queue them for gapless transition.
+// CAN FATAL.
+void jf_playback_playlist_extended(void);
+
+
 // Will print part or the entirety of the current jftui playback playlist to
 // stdout.
 //
 //  - slice_height: number of items before AND after to try to print.
-//      If 0 will print whole playlist.
+//      If 0 will print whole playlist. Items left out of the window are
+//      summarized by a single line.
 //
 // CAN'T FAIL.
 void jf_playback_print_playlist(size_t slice_height);
@@ -8,6 +8,9 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 ////////// GLOBALS //////////
 extern jf_global_state g_state;
@@ -16,10 +19,45 @@ extern mpv_handle *g_mpv_ctx;
 /////////////////////////////
 
 
+////////// STATIC VARIABLES //////////
+static pthread_key_t s_scratch_key;
+static pthread_once_t s_scratch_once = PTHREAD_ONCE_INIT;
+
+// properties playback sets, restored by jf_end_playback to what the core had
+// right after mpv_initialize (i.e. mpv.conf included)
+static const char *s_mpv_reset_properties[] = {
+    "start",
+    "force-media-title",
+    "title",
+    "sub-delay",
+    "options/loop-playlist"
+};
+static char *s_mpv_reset_values[JF_STATIC_ARRAY_COUNT(s_mpv_reset_properties)] = { 0 };
+//////////////////////////////////////
+
+
 ////////// STATIC FUNCTIONS //////////
 #ifdef JF_DEBUG
 static void jf_menu_item_print_indented(const jf_menu_item *item, const size_t level);
 #endif
+
+static void jf_growing_buffer_scratch_key_init(void);
+static void jf_growing_buffer_scratch_destroy(void *buffer);
+
+static inline void jf_futex_wait(_Atomic uint32_t *word, const uint32_t expected);
+static inline void jf_futex_wake(_Atomic uint32_t *word, const int count);
+
+static bool jf_synced_queue_ring_push(jf_synced_queue *q, const void *payload);
+static bool jf_synced_queue_ring_pop(jf_synced_queue *q, const void **payload);
+static inline void jf_synced_queue_signal(_Atomic uint32_t *word,
+        _Atomic uint32_t *parked,
+        const int count);
+static void jf_synced_queue_overflow_push(jf_synced_queue *q, const void *payload);
+static bool jf_synced_queue_overflow_drain(jf_synced_queue *q);
+
+// Fills s_mpv_reset_values from ctx, freshly initialized.
+// CAN'T FAIL.
+static void jf_mpv_reset_values_snapshot(mpv_handle *ctx);
 //////////////////////////////////////
 
 
@@ -105,6 +143,8 @@ jf_menu_item *jf_menu_item_new(jf_item_type type, jf_menu_item **children,
     menu_item->name = name == NULL ? NULL : strdup(name);
     menu_item->runtime_ticks = runtime_ticks;
     menu_item->playback_ticks = playback_ticks;
+    menu_item->part_count = 0;
+    menu_item->played = false;
     
     return menu_item;
 }
@@ -219,62 +259,307 @@ void jf_growing_buffer_free(jf_growing_buffer *buffer)
     free(buffer->buf);
     free(buffer);
 }
+
+
+const char *jf_growing_buffer_cstr(jf_growing_buffer *buffer)
+{
+    jf_growing_buffer_append(buffer, "", 1);
+    buffer->used--;
+    return buffer->buf;
+}
+
+
+static void jf_growing_buffer_scratch_key_init()
+{
+    assert(pthread_key_create(&s_scratch_key,
+                jf_growing_buffer_scratch_destroy) == 0);
+}
+
+
+static void jf_growing_buffer_scratch_destroy(void *buffer)
+{
+    jf_growing_buffer_free((jf_growing_buffer *)buffer);
+}
+
+
+jf_growing_buffer *jf_growing_buffer_scratch()
+{
+    jf_growing_buffer *buffer;
+
+    assert(pthread_once(&s_scratch_once, jf_growing_buffer_scratch_key_init) == 0);
+    if ((buffer = pthread_getspecific(s_scratch_key)) == NULL) {
+        buffer = jf_growing_buffer_new(256);
+        assert(pthread_setspecific(s_scratch_key, buffer) == 0);
+    }
+    jf_growing_buffer_empty(buffer);
+    return buffer;
+}
 ////////////////////////////////////
 
 
 ////////// SYNCED QUEUE //////////
-jf_synced_queue *jf_synced_queue_new(const size_t slots)
+static inline void jf_futex_wait(_Atomic uint32_t *word, const uint32_t expected)
+{
+    // spurious wakeups and EAGAIN are fine: callers loop
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+
+static inline void jf_futex_wake(_Atomic uint32_t *word, const int count)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+
+jf_synced_queue *jf_synced_queue_new(const size_t slot_count, const bool overflow)
 {
     jf_synced_queue *q;
+    size_t i, slots = 2;
+
+    while (slots < slot_count) {
+        slots *= 2;
+    }
 
-    assert((q = malloc(sizeof(jf_synced_queue))) != NULL);
-    assert((q->slots = calloc(slots, sizeof(void *))) != NULL);
+    assert((q = aligned_alloc(JF_CACHELINE_SIZE, sizeof(jf_synced_queue))) != NULL);
+    assert((q->cells = malloc(slots * sizeof(jf_synced_queue_cell))) != NULL);
+    for (i = 0; i < slots; i++) {
+        atomic_init(&q->cells[i].sequence, i);
+        q->cells[i].payload = NULL;
+    }
     q->slot_count = slots;
-    q->current = 0;
-    q->next = 0;
-    assert(pthread_mutex_init(&q->mut, NULL) == 0);
-    assert(pthread_cond_init(&q->cv_is_empty, NULL) == 0);
-    assert(pthread_cond_init(&q->cv_is_full, NULL) == 0);
+    q->overflow = overflow;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    atomic_init(&q->not_empty, 0);
+    atomic_init(&q->consumers_parked, 0);
+    atomic_init(&q->not_full, 0);
+    atomic_init(&q->producers_parked, 0);
+    atomic_init(&q->overflow_count, 0);
+    assert(pthread_mutex_init(&q->overflow_mut, NULL) == 0);
+    q->overflow_slots = NULL;
+    q->overflow_size = 0;
+    q->overflow_head = 0;
     return q;
 }
 
 
 void jf_synced_queue_free(jf_synced_queue *q)
 {
+    if (q == NULL) return;
+    pthread_mutex_destroy(&q->overflow_mut);
+    free(q->overflow_slots);
+    free(q->cells);
     free(q);
 }
 
 
+static bool jf_synced_queue_ring_push(jf_synced_queue *q, const void *payload)
+{
+    jf_synced_queue_cell *cell;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    while (true) {
+        cell = q->cells + (pos & (q->slot_count - 1));
+        seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // full
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    cell->payload = payload;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+
+static bool jf_synced_queue_ring_pop(jf_synced_queue *q, const void **payload)
+{
+    jf_synced_queue_cell *cell;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    while (true) {
+        cell = q->cells + (pos & (q->slot_count - 1));
+        seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // empty
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+    *payload = cell->payload;
+    atomic_store_explicit(&cell->sequence, pos + q->slot_count, memory_order_release);
+    return true;
+}
+
+
+static inline void jf_synced_queue_signal(_Atomic uint32_t *word,
+        _Atomic uint32_t *parked,
+        const int count)
+{
+    // seq_cst pairs with the parking side incrementing parked before its
+    // last attempt, so either it sees our item or we see it parked
+    atomic_fetch_add(word, 1);
+    if (atomic_load(parked) > 0) {
+        jf_futex_wake(word, count);
+    }
+}
+
+
+// Must be called with overflow_mut held.
+static void jf_synced_queue_overflow_push(jf_synced_queue *q, const void *payload)
+{
+    const void **slots;
+    size_t i, count = atomic_load_explicit(&q->overflow_count, memory_order_relaxed);
+
+    if (count == q->overflow_size) {
+        // grow, unrolling the ring to start at 0
+        q->overflow_size = q->overflow_size == 0 ? q->slot_count : q->overflow_size * 2;
+        assert((slots = malloc(q->overflow_size * sizeof(void *))) != NULL);
+        for (i = 0; i < count; i++) {
+            slots[i] = q->overflow_slots[(q->overflow_head + i) % count];
+        }
+        free(q->overflow_slots);
+        q->overflow_slots = slots;
+        q->overflow_head = 0;
+    }
+    q->overflow_slots[(q->overflow_head + count) % q->overflow_size] = payload;
+    atomic_store_explicit(&q->overflow_count, count + 1, memory_order_release);
+}
+
+
+// Moves as many spilled items as fit back into the ring, oldest first.
+// Returns true if any was moved.
+static bool jf_synced_queue_overflow_drain(jf_synced_queue *q)
+{
+    size_t count, moved = 0;
+
+    if (atomic_load_explicit(&q->overflow_count, memory_order_acquire) == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&q->overflow_mut);
+    count = atomic_load_explicit(&q->overflow_count, memory_order_relaxed);
+    while (count > 0
+            && jf_synced_queue_ring_push(q, q->overflow_slots[q->overflow_head])) {
+        q->overflow_head = (q->overflow_head + 1) % q->overflow_size;
+        count--;
+        moved++;
+    }
+    atomic_store_explicit(&q->overflow_count, count, memory_order_release);
+    pthread_mutex_unlock(&q->overflow_mut);
+
+    if (moved > 0) {
+        jf_synced_queue_signal(&q->not_empty, &q->consumers_parked, (int)moved);
+    }
+    return moved > 0;
+}
+
+
 void jf_synced_queue_enqueue(jf_synced_queue *q, const void *payload)
 {
+    uint32_t seq;
+
     if (payload == NULL) return;
 
-    pthread_mutex_lock(&q->mut);
-    while (q->slots[q->next] != NULL) {
-        pthread_cond_wait(&q->cv_is_full, &q->mut);
+    if (q->overflow) {
+        // once something spilled, everything after it must spill too or
+        // it would overtake it
+        if (atomic_load_explicit(&q->overflow_count, memory_order_acquire) == 0
+                && jf_synced_queue_ring_push(q, payload)) {
+            jf_synced_queue_signal(&q->not_empty, &q->consumers_parked, 1);
+            return;
+        }
+        pthread_mutex_lock(&q->overflow_mut);
+        if (atomic_load_explicit(&q->overflow_count, memory_order_relaxed) == 0
+                && jf_synced_queue_ring_push(q, payload)) {
+            pthread_mutex_unlock(&q->overflow_mut);
+        } else {
+            jf_synced_queue_overflow_push(q, payload);
+            pthread_mutex_unlock(&q->overflow_mut);
+        }
+        // consumers that found the ring empty must come and drain
+        jf_synced_queue_signal(&q->not_empty, &q->consumers_parked, 1);
+        return;
+    }
+
+    while (! jf_synced_queue_ring_push(q, payload)) {
+        seq = atomic_load(&q->not_full);
+        atomic_fetch_add(&q->producers_parked, 1);
+        if (jf_synced_queue_ring_push(q, payload)) {
+            atomic_fetch_sub(&q->producers_parked, 1);
+            break;
+        }
+        jf_futex_wait(&q->not_full, seq);
+        atomic_fetch_sub(&q->producers_parked, 1);
     }
-    q->slots[q->next] = payload;
-    q->next = (q->next + 1) % q->slot_count;
-    pthread_mutex_unlock(&q->mut);
-    pthread_cond_signal(&q->cv_is_empty);
+    jf_synced_queue_signal(&q->not_empty, &q->consumers_parked, 1);
+}
+
+
+void *jf_synced_queue_poll(jf_synced_queue *q)
+{
+    const void *payload;
+
+    if (jf_synced_queue_ring_pop(q, &payload)
+            || (q->overflow
+                && jf_synced_queue_overflow_drain(q)
+                && jf_synced_queue_ring_pop(q, &payload))) {
+        if (q->overflow) {
+            jf_synced_queue_overflow_drain(q);
+        } else {
+            jf_synced_queue_signal(&q->not_full, &q->producers_parked, 1);
+        }
+        return (void *)payload;
+    }
+    return NULL;
 }
 
 
 void *jf_synced_queue_dequeue(jf_synced_queue *q)
 {
-    void *payload;
+    const void *payload;
+    uint32_t seq;
+
+    while (! jf_synced_queue_ring_pop(q, &payload)) {
+        if (q->overflow && jf_synced_queue_overflow_drain(q)) continue;
+        seq = atomic_load(&q->not_empty);
+        atomic_fetch_add(&q->consumers_parked, 1);
+        if (jf_synced_queue_ring_pop(q, &payload)) {
+            atomic_fetch_sub(&q->consumers_parked, 1);
+            break;
+        }
+        if (! (q->overflow && atomic_load(&q->overflow_count) > 0)) {
+            jf_futex_wait(&q->not_empty, seq);
+        }
+        atomic_fetch_sub(&q->consumers_parked, 1);
+    }
 
-    pthread_mutex_lock(&q->mut);
-    while (q->slots[q->current] == NULL) {
-        pthread_cond_wait(&q->cv_is_empty, &q->mut);
+    if (q->overflow) {
+        jf_synced_queue_overflow_drain(q);
+    } else {
+        jf_synced_queue_signal(&q->not_full, &q->producers_parked, 1);
     }
-    payload = (void *)q->slots[q->current];
-    q->slots[q->current] = NULL;
-    q->current = (q->current + 1) % q->slot_count;
-    pthread_mutex_unlock(&q->mut);
-    pthread_cond_signal(&q->cv_is_full);
 
-    return payload;
+    return (void *)payload;
 }
 //////////////////////////////////
 
@@ -282,31 +567,25 @@ void *jf_synced_queue_dequeue(jf_synced_queue *q)
 ////////// MISCELLANEOUS GARBAGE //////////
 char *jf_concat(size_t n, ...)
 {
-    char *buf;
-    size_t *argv_len;
+    char *buf, *end;
     size_t len = 0;
     size_t i;
     va_list ap;
 
-    assert((argv_len = malloc(sizeof(size_t) * n)) != NULL);
     va_start(ap, n);
     for (i = 0; i < n; i++) {
-        argv_len[i] = strlen(va_arg(ap, const char*));
-        len += argv_len[i];
+        len += strlen(va_arg(ap, const char*));
     }
     va_end(ap);
 
     assert((buf = malloc(len + 1)) != NULL);
-    len = 0;
+    end = buf;
     va_start(ap, n);
     for (i = 0; i < n; i++) {
-        memcpy(buf + len, va_arg(ap, const char*), argv_len[i]);
-        len += argv_len[i];
+        end = stpcpy(end, va_arg(ap, const char*));
     }
-    buf[len] = '\0';
     va_end(ap);
     
-    free(argv_len);
     return buf;
 }
 
@@ -345,7 +624,7 @@ mpv_handle *jf_mpv_context_new()
 {
     mpv_handle *ctx;
     int mpv_flag_yes = 1;
-    char *x_emby_token;
+    jf_growing_buffer *x_emby_token;
 
     assert((ctx = mpv_create()) != NULL);
     JF_MPV_ASSERT(JF_MPV_SET_OPTPROP(ctx, "config-dir", MPV_FORMAT_STRING, &g_state.config_dir));
@@ -355,46 +634,133 @@ mpv_handle *jf_mpv_context_new()
     JF_MPV_ASSERT(JF_MPV_SET_OPTPROP(ctx, "input-vo-keyboard", MPV_FORMAT_FLAG, &mpv_flag_yes));
     JF_MPV_ASSERT(JF_MPV_SET_OPTPROP(ctx, "input-terminal", MPV_FORMAT_FLAG, &mpv_flag_yes));
     JF_MPV_ASSERT(JF_MPV_SET_OPTPROP(ctx, "terminal", MPV_FORMAT_FLAG, &mpv_flag_yes));
-    assert((x_emby_token = jf_concat(2, "x-emby-token: ", g_options.token)) != NULL);
-    JF_MPV_ASSERT(JF_MPV_SET_OPTPROP_STRING(ctx, "http-header-fields", x_emby_token));
-    free(x_emby_token);
-    JF_MPV_ASSERT(mpv_observe_property(ctx, 0, "time-pos", MPV_FORMAT_INT64));
-    JF_MPV_ASSERT(mpv_observe_property(ctx, 0, "sid", MPV_FORMAT_INT64));
-    JF_MPV_ASSERT(mpv_observe_property(ctx, 0, "options/loop-playlist", MPV_FORMAT_NODE));
+    x_emby_token = jf_growing_buffer_scratch();
+    JF_GROWING_BUFFER_APPEND_LITERAL(x_emby_token, "x-emby-token: ");
+    jf_growing_buffer_append(x_emby_token, g_options.token, 0);
+    JF_MPV_ASSERT(JF_MPV_SET_OPTPROP_STRING(ctx,
+                "http-header-fields",
+                jf_growing_buffer_cstr(x_emby_token)));
+    // time-pos is sampled on a timer instead (see main.c)
+    JF_MPV_ASSERT(mpv_observe_property(ctx, JF_MPV_OBSERVER_SID, "sid", MPV_FORMAT_INT64));
+    JF_MPV_ASSERT(mpv_observe_property(ctx, JF_MPV_OBSERVER_TRACK_LIST, "track-list", MPV_FORMAT_NONE));
+    JF_MPV_ASSERT(mpv_observe_property(ctx,
+                JF_MPV_OBSERVER_LOOP_PLAYLIST,
+                "options/loop-playlist",
+                MPV_FORMAT_NODE));
+    // open and buffer the next queued audio track while the current one
+    // plays; older mpv versions lack the option, which is merely a loss
+    if (JF_MPV_SET_OPTPROP_STRING(ctx, "prefetch-playlist", "yes") < 0) {
+        fprintf(stderr, "Warning: mpv does not support prefetch-playlist, audio tracks will not be prefetched.\n");
+    }
 
     g_state.playlist_loops = 0;
     g_state.loop_state = JF_LOOP_STATE_IN_SYNC;
+    g_state.playlist_queued = 0;
 
     JF_MPV_ASSERT(mpv_initialize(ctx));
+    jf_mpv_reset_values_snapshot(ctx);
 
     return ctx;
 }
 
 
+static void jf_mpv_reset_values_snapshot(mpv_handle *ctx)
+{
+    size_t i;
+
+    for (i = 0; i < JF_STATIC_ARRAY_COUNT(s_mpv_reset_properties); i++) {
+        mpv_free(s_mpv_reset_values[i]);
+        // NULL if unavailable, in which case it is left alone on reset
+        s_mpv_reset_values[i] = mpv_get_property_string(ctx, s_mpv_reset_properties[i]);
+    }
+}
+
+
+size_t jf_mpv_loop_playlist_count(const mpv_node *node)
+{
+    switch (node->format) {
+        case MPV_FORMAT_FLAG:
+            // "no"
+            return 0;
+        case MPV_FORMAT_INT64:
+            // a (guaranteed positive) numeral
+            return (size_t)node->u.int64;
+        case MPV_FORMAT_STRING:
+            // "yes", "inf" or "force", which we treat the same
+            return (size_t)-1;
+        default:
+            return 0;
+    }
+}
+
+
 void jf_end_playback()
 {
-    // otherwise, kill playback core to reset all values
+    int idle_active = 0;
+    const char *stop[] = { "stop", NULL };
+    const char *playlist_clear[] = { "playlist-clear", NULL };
+    mpv_node loop_playlist;
+    size_t i;
+
+    // reset the core in place rather than making a new one: that would
+    // re-read the config and re-register everything, while what playback
+    // leaves behind is the playlist and the few options jftui sets
+    mpv_get_property(g_mpv_ctx, "idle-active", MPV_FORMAT_FLAG, &idle_active);
+    if (idle_active) {
+        // no MPV_EVENT_IDLE will come to take us back to the menu: if we
+        // are in the menu loop (e.g. an item failed to load) we stay there,
+        // otherwise the menu is entered on the pending idle event
+        g_state.state = JF_STATE_MENU_UI;
+    } else {
+        // the stop will end in MPV_EVENT_IDLE, which must not be mistaken
+        // for the gap between two items
+        g_state.state = JF_STATE_PLAYBACK;
+        JF_MPV_ASSERT(mpv_command(g_mpv_ctx, stop));
+    }
+    JF_MPV_ASSERT(mpv_command(g_mpv_ctx, playlist_clear));
+    for (i = 0; i < JF_STATIC_ARRAY_COUNT(s_mpv_reset_properties); i++) {
+        if (s_mpv_reset_values[i] == NULL) continue;
+        JF_MPV_ASSERT(mpv_set_property_string(g_mpv_ctx,
+                    s_mpv_reset_properties[i],
+                    s_mpv_reset_values[i]));
+    }
+    // the observer takes a change of loop-playlist for the user's doing and
+    // lands on the same count; it may not fire if nothing changed, though
+    g_state.playlist_loops = 0;
+    if (mpv_get_property(g_mpv_ctx, "options/loop-playlist", MPV_FORMAT_NODE, &loop_playlist) == 0) {
+        g_state.playlist_loops = jf_mpv_loop_playlist_count(&loop_playlist);
+        mpv_free_node_contents(&loop_playlist);
+    }
+    g_state.loop_state = JF_LOOP_STATE_IN_SYNC;
+    g_state.playlist_queued = 0;
+
+    // and enforce a clean state for the application
+    jf_menu_item_free(g_state.now_playing);
+    g_state.now_playing = NULL;
+    g_state.playlist_position = 0;
+}
+
+
+void jf_end_playback_shutdown()
+{
+    // the core aborted on its own (e.g. the user quit mpv): nothing to
+    // reset, it has to be made anew
     mpv_terminate_destroy(g_mpv_ctx);
     g_mpv_ctx = jf_mpv_context_new();
-    // and enforce a clean state for the application
     jf_menu_item_free(g_state.now_playing);
     g_state.now_playing = NULL;
     g_state.playlist_position = 0;
 }
 
 
-char *jf_make_timestamp(const long long ticks)
+void jf_make_timestamp(const long long ticks, char *str)
 {
-    char *str;
     unsigned char seconds, minutes, hours;
     seconds = (ticks / 10000000) % 60;
     minutes = (ticks / 10000000 / 60) % 60;
     hours = (unsigned char)(ticks / 10000000 / 60 / 60);
 
-    // allocate with overestimate. we shan't cry
-    assert((str = malloc(sizeof("xxx:xx:xx"))) != NULL);
-    snprintf(str, sizeof("xxx:xx:xx"), "%02u:%02u:%02u", hours, minutes, seconds);
-    return str;
+    snprintf(str, JF_TIMESTAMP_SIZE, "%02u:%02u:%02u", hours, minutes, seconds);
 }
 
 
@@ -5,6 +5,9 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
 #include <curl/curl.h>
@@ -14,6 +17,7 @@
 ////////// CODE MACROS //////////
 // for hardcoded strings
 #define JF_STATIC_STRLEN(str) (sizeof(str) - 1)
+#define JF_STATIC_ARRAY_COUNT(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 // for progress
 #define JF_TICKS_TO_SECS(t) (t) / 10000000
@@ -79,6 +83,52 @@ void jf_exit(int sig);
 /////////////////////////////////////////
 
 
+////////// EVENT LOOP //////////
+// Note: the code for these functions is defined in the main.c TU.
+// The main loop sleeps in epoll on the mpv wakeup pipe, async network
+// completions and, while at a prompt, the terminal.
+
+// Blocks until fd (the terminal) is readable. While the menu is up
+// (JF_STATE_MENU_UI, or browsing during playback) mpv events keep being
+// dispatched meanwhile; elsewhere (prompts in the middle of playback
+// transitions, or nested in a dispatch) it returns at once and the caller's
+// read blocks as usual.
+// Registered as the linenoise wait callback.
+// CAN FATAL.
+void jf_event_loop_wait_input(int fd);
+
+
+// see net.h
+struct jf_reply;
+
+// Blocks until the async request of reply is done, dispatching mpv events
+// meanwhile.
+// CAN FATAL.
+void jf_event_loop_await(struct jf_reply *reply);
+
+
+// reply_userdata of the mpv_observe_property calls, which index the table of
+// property change handlers in main.c
+typedef enum jf_mpv_observer {
+    JF_MPV_OBSERVER_NONE = 0,
+    JF_MPV_OBSERVER_SID = 1,
+    JF_MPV_OBSERVER_LOOP_PLAYLIST = 2,
+    JF_MPV_OBSERVER_TRACK_LIST = 3
+} jf_mpv_observer;
+
+#define JF_MPV_OBSERVER_COUNT 4
+
+
+typedef void (*jf_mpv_property_handler)(const mpv_event_property *property);
+
+
+typedef struct jf_mpv_client_message_handler {
+    const char *name;
+    void (*handler)(const mpv_event_client_message *message);
+} jf_mpv_client_message_handler;
+////////////////////////////////
+
+
 ////////// GENERIC JELLYFIN ITEM REPRESENTATION //////////
 // Information about persistency is used to make part of the menu interface
 // tree not get deallocated when navigating upwards
@@ -145,6 +195,11 @@ typedef struct jf_menu_item {
     char *name;
     long long playback_ticks;
     long long runtime_ticks;
+    // PartCount of a video as told by the listing it came from, 0 if unknown
+    size_t part_count;
+    // parts of a split-file video only: whether the server had the part
+    // played when the video was resolved
+    bool played;
 } jf_menu_item;
 
 
@@ -190,10 +245,35 @@ typedef struct jf_growing_buffer {
 } jf_growing_buffer;
 
 
+// Appends a string literal, its length being computed at compile time.
+#define JF_GROWING_BUFFER_APPEND_LITERAL(_b, _lit) \
+    jf_growing_buffer_append((_b), (_lit), JF_STATIC_STRLEN(_lit))
+
+
 jf_growing_buffer *jf_growing_buffer_new(const size_t size);
 void jf_growing_buffer_append(jf_growing_buffer *buffer, const void *data, const size_t length);
 void jf_growing_buffer_empty(jf_growing_buffer *buffer);
 void jf_growing_buffer_free(jf_growing_buffer *buffer);
+
+
+// \0-terminates the contents of the buffer without counting the terminator as
+// used, so that further appends will overwrite it.
+//
+// Returns:
+//  A pointer to the contents, valid until the buffer is next modified.
+// CAN FATAL.
+const char *jf_growing_buffer_cstr(jf_growing_buffer *buffer);
+
+
+// Returns the scratch buffer of the calling thread, emptied. It is meant for
+// short-lived strings on hot paths (request URLs, headers...), so that
+// building them does not allocate once the buffer has grown to size.
+// Its contents are only valid until the next call to this function from the
+// same thread. The buffer is allocated on first use and freed when the thread
+// exits.
+//
+// CAN FATAL.
+jf_growing_buffer *jf_growing_buffer_scratch(void);
 ////////////////////////////////////
 
 
@@ -256,26 +336,61 @@ typedef struct jf_global_state {
     jf_menu_item *now_playing;
     // 1-indexed
     size_t playlist_position;
+    // items after playlist_position already appended to mpv's own playlist
+    // (gapless audio), which mpv moves on to by itself at EOF
+    size_t playlist_queued;
     // counter for playlist loops to do
     // infinite loops are approximated by 2^64-1
     size_t playlist_loops;
     jf_loop_state loop_state;
+    // --stats: print jf_stats_print report on exit
+    bool stats_on_exit;
 } jf_global_state;
 //////////////////////////////////////////////
 
 
 ////////// SYNCED QUEUE //////////
+// Bounded lock-free MPMC queue (sequence numbers per cell, as per D. Vyukov).
+// Threads only park on a futex when the ring is truly empty (consumers) or
+// full (producers, when not in overflow mode).
+#define JF_CACHELINE_SIZE 64
+
+typedef struct jf_synced_queue_cell {
+    atomic_size_t sequence;
+    const void *payload;
+} jf_synced_queue_cell;
+
 typedef struct jf_synced_queue {
-    const void **slots;
+    jf_synced_queue_cell *cells;
     size_t slot_count;
-    size_t current;
-    size_t next;
-    pthread_mutex_t mut;
-    pthread_cond_t cv_is_empty;
-    pthread_cond_t cv_is_full;
+    bool overflow;
+    // keep producers and consumers off each other's cache lines
+    alignas(JF_CACHELINE_SIZE) atomic_size_t enqueue_pos;
+    alignas(JF_CACHELINE_SIZE) atomic_size_t dequeue_pos;
+    // futex words, bumped on every enqueue (dequeue) that may wake a parked
+    // consumer (producer)
+    alignas(JF_CACHELINE_SIZE) _Atomic uint32_t not_empty;
+    _Atomic uint32_t consumers_parked;
+    _Atomic uint32_t not_full;
+    _Atomic uint32_t producers_parked;
+    // overflow mode: FIFO spill area used while the ring is full
+    alignas(JF_CACHELINE_SIZE) atomic_size_t overflow_count;
+    pthread_mutex_t overflow_mut;
+    const void **overflow_slots;
+    size_t overflow_size;
+    size_t overflow_head;
 } jf_synced_queue;
 
-jf_synced_queue *jf_synced_queue_new(const size_t slot_count);
+// Allocates a new queue.
+//
+// Parameters:
+//  - slot_count: size of the ring; rounded up to a power of 2 (minimum 2).
+//  - overflow: if true, enqueueing never blocks: items that do not fit the
+//      ring are spilled to a growable area and moved back into the ring in
+//      order as consumers make room. If false, producers block while the ring
+//      is full.
+// CAN FATAL.
+jf_synced_queue *jf_synced_queue_new(const size_t slot_count, const bool overflow);
 
 // Deallocates the queue but NOT its contents.
 //
@@ -284,9 +399,22 @@ jf_synced_queue *jf_synced_queue_new(const size_t slot_count);
 // CAN'T FAIL.
 void jf_synced_queue_free(jf_synced_queue *q); 
 
+// Enqueues payload (a NULL payload is a no-op). Blocks while the queue is
+// full unless it was created in overflow mode.
+// CAN FATAL.
 void jf_synced_queue_enqueue(jf_synced_queue *q, const void *payload);
 
+// Dequeues the oldest payload, blocking while the queue is empty.
+// CAN'T FAIL.
 void *jf_synced_queue_dequeue(jf_synced_queue *q);
+
+// Like jf_synced_queue_dequeue but never blocks.
+//
+// Returns:
+//  The oldest payload or NULL if none is ready (note that an item whose
+//  enqueue is still in flight may be briefly invisible).
+// CAN'T FAIL.
+void *jf_synced_queue_poll(jf_synced_queue *q);
 //////////////////////////////////
 
 
@@ -332,9 +460,43 @@ void jf_print_zu(size_t n);
 char *jf_generate_random_id(size_t length);
 
 
+// Creates and initializes a core, then takes note of the values (mpv.conf
+// included) of the properties playback sets, for jf_end_playback.
+// CAN FATAL.
 mpv_handle *jf_mpv_context_new(void);
+
+
+// Maps the value of loop-playlist to a number of loops, (size_t)-1 for
+// infinite ones.
+// CAN'T FAIL.
+size_t jf_mpv_loop_playlist_count(const mpv_node *node);
+
+
+// Stops playback and empties the playlist of g_mpv_ctx, restoring start,
+// force-media-title, title, sub-delay and loop-playlist to the values
+// jf_mpv_context_new found after initialization, without recreating the core.
+// Other properties changed during playback (e.g. by the user from mpv) are
+// kept. Clears the playback fields of g_state.
+// Events of the session may still be queued after this returns, with
+// g_state.now_playing == NULL.
+// CAN FATAL.
 void jf_end_playback(void);
-char *jf_make_timestamp(const long long ticks);
+
+
+// For MPV_EVENT_SHUTDOWN, where the core is gone and can't be reset: destroys
+// g_mpv_ctx and makes a new one, then clears the playback fields of g_state.
+// CAN FATAL.
+void jf_end_playback_shutdown(void);
+
+
+// Size of a buffer able to hold any timestamp made by jf_make_timestamp,
+// terminator included.
+#define JF_TIMESTAMP_SIZE sizeof("xxx:xx:xx")
+
+// Prints ticks as a "hh:mm:ss" timestamp to str, which must be at least
+// JF_TIMESTAMP_SIZE bytes long.
+// CAN'T FAIL.
+void jf_make_timestamp(const long long ticks, char *str);
 size_t jf_clamp_zu(const size_t zu, const size_t min, const size_t max);
 void jf_clear_stdin(void);
 
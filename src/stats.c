@@ -0,0 +1,341 @@
+#include "stats.h"
+#include "shared.h"
+#include "net.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <mpv/client.h>
+
+
+////////// STATIC VARIABLES //////////
+// indexed through jf_stats_request_type_index
+static const char *s_request_type_names[] = {
+    "in-memory",
+    "sax",
+    "sax-promiscuous",
+    "async",
+    "detach",
+    "update-check",
+    "prefetch",
+    "download"
+};
+
+#define JF_STATS_REQUEST_TYPE_COUNT (sizeof(s_request_type_names) / sizeof(*s_request_type_names))
+
+static const char *s_net_phase_names[JF_STATS_NET_PHASE_COUNT] = {
+    "dns",
+    "connect",
+    "tls",
+    "ttfb",
+    "total"
+};
+
+static const char *s_disk_op_names[JF_STATS_DISK_OP_COUNT] = {
+    "write",
+    "read",
+    "compact"
+};
+
+static struct {
+    atomic_size_t requests;
+    atomic_size_t failed;
+    atomic_uint_fast64_t bytes_received;
+    jf_stats_histogram phases[JF_STATS_NET_PHASE_COUNT];
+} s_net[JF_STATS_REQUEST_TYPE_COUNT];
+
+static struct {
+    atomic_size_t items;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t parse_us;
+    jf_stats_histogram documents;
+} s_parser;
+
+static struct {
+    atomic_uint_fast64_t bytes;
+    atomic_size_t calls;
+    jf_stats_histogram ops;
+} s_disk[JF_STATS_DISK_OP_COUNT];
+
+static struct {
+    atomic_size_t live_bytes;
+    atomic_size_t dead_bytes;
+} s_playlist;
+
+static jf_stats_histogram s_mpv[JF_STATS_MPV_EVENT_SLOTS];
+//////////////////////////////////////
+
+
+////////// STATIC FUNCTIONS //////////
+static int jf_stats_request_type_index(const jf_request_type type);
+static uint64_t jf_stats_histogram_percentile(const jf_stats_histogram *h, const double p);
+static void jf_stats_format_us(char *str, const size_t size, const uint64_t us);
+static void jf_stats_format_bytes(char *str, const size_t size, const uint64_t bytes);
+static void jf_stats_histogram_print(FILE *stream, const char *label, const jf_stats_histogram *h);
+//////////////////////////////////////
+
+
+////////// HISTOGRAM //////////
+uint64_t jf_stats_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+void jf_stats_histogram_record(jf_stats_histogram *h, const uint64_t us)
+{
+    size_t bucket;
+    uint_fast64_t max;
+
+    bucket = us == 0 ? 0 : (size_t)(64 - __builtin_clzll((unsigned long long)us));
+    if (bucket >= JF_STATS_HISTOGRAM_BUCKETS) {
+        bucket = JF_STATS_HISTOGRAM_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_us, us, memory_order_relaxed);
+    max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    while (us > max
+            && ! atomic_compare_exchange_weak_explicit(&h->max_us,
+                &max,
+                us,
+                memory_order_relaxed,
+                memory_order_relaxed)) {
+        // max reloaded by the failed exchange
+    }
+}
+
+
+// Returns the upper bound of the bucket holding the p-th quantile, clamped
+// to the largest sample seen.
+static uint64_t jf_stats_histogram_percentile(const jf_stats_histogram *h, const double p)
+{
+    size_t count, target, seen = 0, i;
+    uint64_t max;
+
+    count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    target = (size_t)(p * (double)count + 0.5);
+    if (target == 0) target = 1;
+    for (i = 0; i < JF_STATS_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        if (seen >= target) {
+            return (1ull << i) < max ? (1ull << i) : max;
+        }
+    }
+    return max;
+}
+
+
+static void jf_stats_format_us(char *str, const size_t size, const uint64_t us)
+{
+    if (us < 1000) {
+        snprintf(str, size, "%" PRIu64 "us", us);
+    } else if (us < 1000000) {
+        snprintf(str, size, "%.1fms", (double)us / 1000);
+    } else {
+        snprintf(str, size, "%.2fs", (double)us / 1000000);
+    }
+}
+
+
+static void jf_stats_format_bytes(char *str, const size_t size, const uint64_t bytes)
+{
+    if (bytes < 1024) {
+        snprintf(str, size, "%" PRIu64 " B", bytes);
+    } else if (bytes < 1024 * 1024) {
+        snprintf(str, size, "%.1f KiB", (double)bytes / 1024);
+    } else {
+        snprintf(str, size, "%.2f MiB", (double)bytes / (1024 * 1024));
+    }
+}
+
+
+static void jf_stats_histogram_print(FILE *stream, const char *label, const jf_stats_histogram *h)
+{
+    size_t count;
+    char mean[16], p50[16], p90[16], p99[16], max[16];
+
+    if ((count = atomic_load_explicit(&h->count, memory_order_relaxed)) == 0) {
+        return;
+    }
+    jf_stats_format_us(mean, sizeof(mean),
+            atomic_load_explicit(&h->sum_us, memory_order_relaxed) / count);
+    jf_stats_format_us(p50, sizeof(p50), jf_stats_histogram_percentile(h, 0.5));
+    jf_stats_format_us(p90, sizeof(p90), jf_stats_histogram_percentile(h, 0.9));
+    jf_stats_format_us(p99, sizeof(p99), jf_stats_histogram_percentile(h, 0.99));
+    jf_stats_format_us(max, sizeof(max),
+            atomic_load_explicit(&h->max_us, memory_order_relaxed));
+    fprintf(stream, "    %-18s %8zu %9s %9s %9s %9s %9s\n",
+            label, count, mean, p50, p90, p99, max);
+}
+///////////////////////////////
+
+
+////////// RECORDING //////////
+static int jf_stats_request_type_index(const jf_request_type type)
+{
+    switch (type) {
+        case JF_REQUEST_IN_MEMORY:
+            return 0;
+        case JF_REQUEST_SAX:
+        case JF_REQUEST_ASYNC_SAX:
+            return 1;
+        case JF_REQUEST_SAX_PROMISCUOUS:
+        case JF_REQUEST_ASYNC_SAX_PROMISCUOUS:
+            return 2;
+        case JF_REQUEST_ASYNC_IN_MEMORY:
+            return 3;
+        case JF_REQUEST_ASYNC_DETACH:
+            return 4;
+        case JF_REQUEST_CHECK_UPDATE:
+            return 5;
+        case JF_REQUEST_ASYNC_PREFETCH:
+            return 6;
+        case JF_REQUEST_ASYNC_DOWNLOAD:
+            return 7;
+        default:
+            return -1;
+    }
+}
+
+
+void jf_stats_net_record(const jf_request_type type, const jf_stats_net_sample *sample)
+{
+    int index;
+    size_t i;
+
+    if ((index = jf_stats_request_type_index(type)) == -1) return;
+
+    atomic_fetch_add_explicit(&s_net[index].requests, 1, memory_order_relaxed);
+    if (sample->failed) {
+        atomic_fetch_add_explicit(&s_net[index].failed, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&s_net[index].bytes_received,
+            sample->bytes_received,
+            memory_order_relaxed);
+    for (i = 0; i < JF_STATS_NET_PHASE_COUNT; i++) {
+        jf_stats_histogram_record(&s_net[index].phases[i], sample->phase_us[i]);
+    }
+}
+
+
+void jf_stats_parser_record(const size_t items, const size_t bytes, const uint64_t parse_us)
+{
+    atomic_fetch_add_explicit(&s_parser.items, items, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s_parser.bytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s_parser.parse_us, parse_us, memory_order_relaxed);
+    jf_stats_histogram_record(&s_parser.documents, parse_us);
+}
+
+
+void jf_stats_disk_record(const jf_stats_disk_op op,
+        const size_t bytes,
+        const size_t calls,
+        const uint64_t us)
+{
+    atomic_fetch_add_explicit(&s_disk[op].bytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s_disk[op].calls, calls, memory_order_relaxed);
+    jf_stats_histogram_record(&s_disk[op].ops, us);
+}
+
+
+void jf_stats_disk_playlist_usage(const size_t live_bytes, const size_t dead_bytes)
+{
+    atomic_store_explicit(&s_playlist.live_bytes, live_bytes, memory_order_relaxed);
+    atomic_store_explicit(&s_playlist.dead_bytes, dead_bytes, memory_order_relaxed);
+}
+
+
+void jf_stats_mpv_record(const mpv_event_id event_id, const uint64_t us)
+{
+    size_t slot = (size_t)event_id;
+
+    if (slot >= JF_STATS_MPV_EVENT_SLOTS) {
+        slot = JF_STATS_MPV_EVENT_SLOTS - 1;
+    }
+    jf_stats_histogram_record(&s_mpv[slot], us);
+}
+///////////////////////////////
+
+
+////////// REPORT //////////
+void jf_stats_print(FILE *stream)
+{
+    size_t i, j, requests, items;
+    uint64_t bytes, parse_us;
+    const char *name;
+    char size[24];
+
+    fprintf(stream, "\n========== jftui stats ==========\n");
+    fprintf(stream, "    %-18s %8s %9s %9s %9s %9s %9s\n",
+            "", "count", "mean", "p50", "p90", "p99", "max");
+
+    fprintf(stream, "network:\n");
+    for (i = 0; i < JF_STATS_REQUEST_TYPE_COUNT; i++) {
+        if ((requests = atomic_load_explicit(&s_net[i].requests, memory_order_relaxed)) == 0) {
+            continue;
+        }
+        jf_stats_format_bytes(size, sizeof(size),
+                atomic_load_explicit(&s_net[i].bytes_received, memory_order_relaxed));
+        fprintf(stream, "  %s: %zu requests, %zu failed, %s received\n",
+                s_request_type_names[i],
+                requests,
+                atomic_load_explicit(&s_net[i].failed, memory_order_relaxed),
+                size);
+        for (j = 0; j < JF_STATS_NET_PHASE_COUNT; j++) {
+            jf_stats_histogram_print(stream, s_net_phase_names[j], &s_net[i].phases[j]);
+        }
+    }
+
+    fprintf(stream, "parser:\n");
+    items = atomic_load_explicit(&s_parser.items, memory_order_relaxed);
+    bytes = atomic_load_explicit(&s_parser.bytes, memory_order_relaxed);
+    parse_us = atomic_load_explicit(&s_parser.parse_us, memory_order_relaxed);
+    if (parse_us > 0) {
+        jf_stats_format_bytes(size, sizeof(size), bytes);
+        fprintf(stream, "  %zu items, %s: %.0f items/s, %.1f MiB/s\n",
+                items,
+                size,
+                (double)items * 1000000 / (double)parse_us,
+                (double)bytes / (1 << 20) * 1000000 / (double)parse_us);
+    }
+    jf_stats_histogram_print(stream, "document", &s_parser.documents);
+
+    fprintf(stream, "disk cache:\n");
+    for (i = 0; i < JF_STATS_DISK_OP_COUNT; i++) {
+        if (atomic_load_explicit(&s_disk[i].ops.count, memory_order_relaxed) == 0) {
+            continue;
+        }
+        jf_stats_format_bytes(size, sizeof(size),
+                atomic_load_explicit(&s_disk[i].bytes, memory_order_relaxed));
+        fprintf(stream, "  %s: %s in %zu stdio calls\n",
+                s_disk_op_names[i],
+                size,
+                atomic_load_explicit(&s_disk[i].calls, memory_order_relaxed));
+        jf_stats_histogram_print(stream, "op", &s_disk[i].ops);
+    }
+    bytes = atomic_load_explicit(&s_playlist.live_bytes, memory_order_relaxed);
+    if (bytes > 0) {
+        jf_stats_format_bytes(size, sizeof(size), bytes);
+        fprintf(stream, "  playlist body: %s live, ", size);
+        jf_stats_format_bytes(size, sizeof(size),
+                atomic_load_explicit(&s_playlist.dead_bytes, memory_order_relaxed));
+        fprintf(stream, "%s dead\n", size);
+    }
+
+    fprintf(stream, "mpv event dispatch:\n");
+    for (i = 0; i < JF_STATS_MPV_EVENT_SLOTS; i++) {
+        if ((name = mpv_event_name((mpv_event_id)i)) == NULL) {
+            name = "other";
+        }
+        jf_stats_histogram_print(stream, name, &s_mpv[i]);
+    }
+    fprintf(stream, "=================================\n");
+}
+////////////////////////////
@@ -0,0 +1,128 @@
+#ifndef _JF_STATS
+#define _JF_STATS
+
+
+#include "net.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+
+// Always-on counters and latency histograms for the hot paths (network,
+// JSON parsing, disk cache, mpv event dispatch).
+// Recording is a handful of relaxed atomic increments, so any thread may
+// record at any time; a report is a best-effort snapshot.
+
+
+////////// CONSTANTS //////////
+// bucket 0 holds samples under 1us, bucket i > 0 those in [2^(i-1), 2^i) us;
+// the last bucket is open-ended (~8.4s and up)
+#define JF_STATS_HISTOGRAM_BUCKETS 24
+
+// mpv_event_id values are small; anything past this shares the last slot
+#define JF_STATS_MPV_EVENT_SLOTS 32
+///////////////////////////////
+
+
+////////// HISTOGRAM //////////
+typedef struct jf_stats_histogram {
+    atomic_size_t count;
+    atomic_uint_fast64_t sum_us;
+    atomic_uint_fast64_t max_us;
+    atomic_size_t buckets[JF_STATS_HISTOGRAM_BUCKETS];
+} jf_stats_histogram;
+///////////////////////////////
+
+
+////////// NETWORK //////////
+typedef enum jf_stats_net_phase {
+    JF_STATS_NET_DNS = 0,
+    JF_STATS_NET_CONNECT = 1,
+    JF_STATS_NET_TLS = 2,
+    // from the request being sent (connection ready) to the first byte back
+    JF_STATS_NET_TTFB = 3,
+    JF_STATS_NET_TOTAL = 4
+} jf_stats_net_phase;
+
+#define JF_STATS_NET_PHASE_COUNT 5
+
+
+// One finished transfer, as reported by libcurl. Durations are per phase
+// (not cumulative since the start of the transfer) and in microseconds.
+typedef struct jf_stats_net_sample {
+    uint64_t phase_us[JF_STATS_NET_PHASE_COUNT];
+    uint64_t bytes_received;
+    bool failed;
+} jf_stats_net_sample;
+/////////////////////////////
+
+
+////////// DISK //////////
+typedef enum jf_stats_disk_op {
+    JF_STATS_DISK_WRITE = 0,
+    JF_STATS_DISK_READ = 1,
+    // bytes are those copied to the new body, read and written once each
+    JF_STATS_DISK_COMPACT = 2
+} jf_stats_disk_op;
+
+#define JF_STATS_DISK_OP_COUNT 3
+//////////////////////////
+
+
+////////// FUNCTION STUBS //////////
+// Monotonic clock, for timing the samples below.
+// CAN'T FAIL.
+uint64_t jf_stats_now_us(void);
+
+
+void jf_stats_histogram_record(jf_stats_histogram *h, const uint64_t us);
+
+
+// CAN'T FAIL.
+void jf_stats_net_record(const jf_request_type type, const jf_stats_net_sample *sample);
+
+
+// Records a fully parsed JSON document.
+//
+// Parameters:
+//  - items: number of items extracted from it.
+//  - bytes: size of the document.
+//  - parse_us: time spent inside the parser (callbacks, and so disk cache
+//      writes, included), excluding waits for data.
+// CAN'T FAIL.
+void jf_stats_parser_record(const size_t items, const size_t bytes, const uint64_t parse_us);
+
+
+// Records one disk cache operation (an item written or read back, a
+// compaction).
+//
+// Parameters:
+//  - bytes: moved to or from the file.
+//  - calls: stdio calls doing so (fread, fwrite, getdelim). Buffering turns
+//      them into fewer actual syscalls.
+//  - us: duration of the whole operation.
+// CAN'T FAIL.
+void jf_stats_disk_record(const jf_stats_disk_op op,
+        const size_t bytes,
+        const size_t calls,
+        const uint64_t us);
+
+
+// Records the current size of the playlist body: bytes referred by the index
+// and garbage left behind by replaced items.
+// CAN'T FAIL.
+void jf_stats_disk_playlist_usage(const size_t live_bytes, const size_t dead_bytes);
+
+
+// Records the time spent handling one mpv event.
+// CAN'T FAIL.
+void jf_stats_mpv_record(const mpv_event_id event_id, const uint64_t us);
+
+
+// Prints a human readable report of everything recorded so far.
+// CAN'T FAIL.
+void jf_stats_print(FILE *stream);
+////////////////////////////////////
+#endif
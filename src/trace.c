@@ -0,0 +1,193 @@
+#include "trace.h"
+#include "stats.h"
+#include "shared.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+////////// STATIC VARIABLES //////////
+static FILE *s_trace_file = NULL;
+static atomic_bool s_enabled = false;
+// serializes writers and guards s_first_event
+static pthread_mutex_t s_mut = PTHREAD_MUTEX_INITIALIZER;
+static bool s_first_event = true;
+static pid_t s_pid;
+static _Thread_local pid_t s_tid = 0;
+//////////////////////////////////////
+
+
+////////// STATIC FUNCTIONS //////////
+static inline pid_t jf_trace_tid(void);
+static void jf_trace_write_event_start(void);
+static void jf_trace_write_escaped(const char *str);
+//////////////////////////////////////
+
+
+static inline pid_t jf_trace_tid(void)
+{
+    if (s_tid == 0) {
+        s_tid = (pid_t)syscall(SYS_gettid);
+    }
+    return s_tid;
+}
+
+
+// Call with s_mut held.
+static void jf_trace_write_event_start(void)
+{
+    if (s_first_event) {
+        s_first_event = false;
+    } else {
+        fputs(",\n", s_trace_file);
+    }
+}
+
+
+// Call with s_mut held.
+static void jf_trace_write_escaped(const char *str)
+{
+    for (; *str != '\0'; str++) {
+        switch (*str) {
+            case '"':
+                fputs("\\\"", s_trace_file);
+                break;
+            case '\\':
+                fputs("\\\\", s_trace_file);
+                break;
+            default:
+                if ((unsigned char)*str < 0x20) {
+                    fprintf(s_trace_file, "\\u%04x", (unsigned char)*str);
+                } else {
+                    fputc(*str, s_trace_file);
+                }
+        }
+    }
+}
+
+
+////////// TRACE FILE //////////
+void jf_trace_open(const char *path)
+{
+    if ((s_trace_file = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "FATAL: could not open trace file %s: ", path);
+        perror(NULL);
+        jf_exit(JF_EXIT_FAILURE);
+    }
+    s_pid = getpid();
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", s_trace_file);
+    atomic_store(&s_enabled, true);
+}
+
+
+void jf_trace_close(void)
+{
+    if (! atomic_exchange(&s_enabled, false)) return;
+
+    pthread_mutex_lock(&s_mut);
+    fputs("\n]}\n", s_trace_file);
+    fclose(s_trace_file);
+    s_trace_file = NULL;
+    pthread_mutex_unlock(&s_mut);
+}
+
+
+bool jf_trace_is_enabled(void)
+{
+    return atomic_load_explicit(&s_enabled, memory_order_relaxed);
+}
+////////////////////////////////
+
+
+////////// EVENTS //////////
+void jf_trace_thread_name(const char *name)
+{
+    if (! jf_trace_is_enabled()) return;
+
+    pthread_mutex_lock(&s_mut);
+    if (s_trace_file != NULL) {
+        jf_trace_write_event_start();
+        fprintf(s_trace_file,
+                "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"",
+                (int)s_pid,
+                (int)jf_trace_tid());
+        jf_trace_write_escaped(name);
+        fputs("\"}}", s_trace_file);
+    }
+    pthread_mutex_unlock(&s_mut);
+}
+
+
+uint64_t jf_trace_begin(void)
+{
+    return jf_trace_is_enabled() ? jf_stats_now_us() : 0;
+}
+
+
+void jf_trace_end(const char *cat, const char *name, const uint64_t start_us, const char *detail)
+{
+    if (start_us == 0 || ! jf_trace_is_enabled()) return;
+    jf_trace_end_span(cat, name, start_us, jf_stats_now_us(), detail);
+}
+
+
+void jf_trace_end_span(const char *cat,
+        const char *name,
+        const uint64_t start_us,
+        const uint64_t end_us,
+        const char *detail)
+{
+    if (start_us == 0 || ! jf_trace_is_enabled()) return;
+
+    pthread_mutex_lock(&s_mut);
+    if (s_trace_file != NULL) {
+        jf_trace_write_event_start();
+        fprintf(s_trace_file,
+                "{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64,
+                cat,
+                name,
+                (int)s_pid,
+                (int)jf_trace_tid(),
+                start_us,
+                end_us > start_us ? end_us - start_us : 0);
+        if (detail != NULL) {
+            fputs(",\"args\":{\"detail\":\"", s_trace_file);
+            jf_trace_write_escaped(detail);
+            fputs("\"}", s_trace_file);
+        }
+        fputc('}', s_trace_file);
+    }
+    pthread_mutex_unlock(&s_mut);
+}
+
+
+void jf_trace_instant(const char *cat, const char *name, const char *detail)
+{
+    if (! jf_trace_is_enabled()) return;
+
+    pthread_mutex_lock(&s_mut);
+    if (s_trace_file != NULL) {
+        jf_trace_write_event_start();
+        fprintf(s_trace_file,
+                "{\"ph\":\"i\",\"s\":\"t\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%" PRIu64,
+                cat,
+                name,
+                (int)s_pid,
+                (int)jf_trace_tid(),
+                jf_stats_now_us());
+        if (detail != NULL) {
+            fputs(",\"args\":{\"detail\":\"", s_trace_file);
+            jf_trace_write_escaped(detail);
+            fputs("\"}", s_trace_file);
+        }
+        fputc('}', s_trace_file);
+    }
+    pthread_mutex_unlock(&s_mut);
+}
+////////////////////////////
@@ -0,0 +1,68 @@
+#ifndef _JF_TRACE
+#define _JF_TRACE
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Timeline of spans in Chrome trace event format (load the file in
+// chrome://tracing or ui.perfetto.dev), enabled with --trace <file>.
+// Each span is written as a complete ("X") event when it ends, tagged with
+// the kernel id of the thread that ran it.
+// When tracing is off, jf_trace_begin returns 0 and every other call is a
+// no-op.
+
+
+////////// FUNCTION STUBS //////////
+// Opens path for writing and starts recording.
+// CAN FATAL.
+void jf_trace_open(const char *path);
+
+
+// Terminates the JSON document and closes the file. Safe to call when
+// tracing was never enabled.
+// CAN'T FAIL.
+void jf_trace_close(void);
+
+
+bool jf_trace_is_enabled(void);
+
+
+// Labels the calling thread on the timeline.
+// CAN'T FAIL.
+void jf_trace_thread_name(const char *name);
+
+
+// Returns:
+//  The span start timestamp to pass to jf_trace_end, 0 if tracing is off.
+// CAN'T FAIL.
+uint64_t jf_trace_begin(void);
+
+
+// Records the span [start_us, now] on the calling thread.
+//
+// Parameters:
+//  - cat, name: static strings, they are not escaped.
+//  - start_us: as returned by jf_trace_begin. 0 makes this a no-op.
+//  - detail: free text shown in the span args, may be NULL.
+// CAN'T FAIL.
+void jf_trace_end(const char *cat, const char *name, const uint64_t start_us, const char *detail);
+
+
+// Same as jf_trace_end, with an explicit end (e.g. for time spent queued,
+// recorded once the request is picked up).
+// CAN'T FAIL.
+void jf_trace_end_span(const char *cat,
+        const char *name,
+        const uint64_t start_us,
+        const uint64_t end_us,
+        const char *detail);
+
+
+// Records a zero-length event on the calling thread.
+// CAN'T FAIL.
+void jf_trace_instant(const char *cat, const char *name, const char *detail);
+////////////////////////////////////
+#endif